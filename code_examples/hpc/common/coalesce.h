@@ -0,0 +1,143 @@
+#ifndef HPC_COMMON_COALESCE_H
+#define HPC_COMMON_COALESCE_H
+
+// Micro-batching of small concurrent calls, shared by the native example modules (C and C++).
+//
+// Callers submit a request to a queue and block until it has run. The first caller to find no
+// batch being collected becomes its leader: it waits until the batch holds max_batch requests
+// or latency_ns has passed since it arrived, detaches the batch, runs all of it with one call
+// of the queue's run function (one dispatch onto the worker pool instead of one per request),
+// then wakes the followers. Requests arriving while a batch runs start collecting the next one.
+//
+// Callers must not hold the GIL while submitting, or the followers could never arrive.
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef struct co_request {
+    struct co_request *next;
+    void *payload;
+    int done;
+} co_request;
+
+typedef struct co_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      // the leader waits here for its batch to fill
+    pthread_cond_t finished;    // followers wait here for their batch to run
+    co_request *head, **tail;
+    size_t count;
+    int collecting;
+    void (*run)(co_request *batch, size_t count, void *ctx);
+    void *ctx;
+    int enabled;                // read without the lock, so callers can skip the queue cheaply
+    long latency_ns;
+    size_t max_batch;
+    unsigned long long batches, requests;
+} co_queue;
+
+static inline void co_init(co_queue *q, void (*run)(co_request *, size_t, void *), void *ctx) {
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->filled, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&q->finished, NULL);
+    q->head = NULL;
+    q->tail = &q->head;
+    q->count = 0;
+    q->collecting = 0;
+    q->run = run;
+    q->ctx = ctx;
+    q->enabled = 0;
+    q->latency_ns = 20000;
+    q->max_batch = 64;
+    q->batches = q->requests = 0;
+}
+
+static inline void co_destroy(co_queue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->filled);
+    pthread_cond_destroy(&q->finished);
+}
+
+static inline int co_enabled(co_queue *q) {
+    return __atomic_load_n(&q->enabled, __ATOMIC_RELAXED);
+}
+
+static inline void co_configure(co_queue *q, int enabled, long latency_ns, size_t max_batch) {
+    pthread_mutex_lock(&q->lock);
+    q->latency_ns = latency_ns > 0 ? latency_ns : 0;
+    q->max_batch = max_batch > 0 ? max_batch : 1;
+    __atomic_store_n(&q->enabled, enabled, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Consistent copy of the settings and counters.
+static inline void co_snapshot(co_queue *q, co_queue *out) {
+    pthread_mutex_lock(&q->lock);
+    out->enabled = q->enabled;
+    out->latency_ns = q->latency_ns;
+    out->max_batch = q->max_batch;
+    out->batches = q->batches;
+    out->requests = q->requests;
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Queue the request and return once the batch holding it has run.
+static inline void co_submit(co_queue *q, co_request *req) {
+    pthread_mutex_lock(&q->lock);
+    req->next = NULL;
+    req->done = 0;
+    *q->tail = req;
+    q->tail = &req->next;
+    q->count++;
+    q->requests++;
+    if (q->collecting) {
+        if (q->count >= q->max_batch) {
+            pthread_cond_signal(&q->filled);
+        }
+        while (!req->done) {
+            pthread_cond_wait(&q->finished, &q->lock);
+        }
+        pthread_mutex_unlock(&q->lock);
+        return;
+    }
+
+    co_request *batch;
+    size_t count;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += q->latency_ns;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    q->collecting = 1;
+    while (q->count < q->max_batch) {
+        if (pthread_cond_timedwait(&q->filled, &q->lock, &deadline) != 0) {
+            break;
+        }
+    }
+    batch = q->head;
+    count = q->count;
+    q->head = NULL;
+    q->tail = &q->head;
+    q->count = 0;
+    q->collecting = 0;
+    q->batches++;
+    pthread_mutex_unlock(&q->lock);
+
+    q->run(batch, count, q->ctx);
+
+    // The followers' requests live on their stacks; they stay blocked on the lock until every
+    // done flag is set.
+    pthread_mutex_lock(&q->lock);
+    for (co_request *r = batch; r; r = r->next) {
+        r->done = 1;
+    }
+    pthread_cond_broadcast(&q->finished);
+    pthread_mutex_unlock(&q->lock);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef HPC_COMMON_TUNING_H
+#define HPC_COMMON_TUNING_H
+
+// Per-host tuning profile shared by the native example modules (C and C++).
+//
+// Profiles are kept in one text file, one "<host key>\t<name>\t<value>" entry per line. The host
+// key is the CPU model and the online core count, so nodes of different types sharing a home
+// directory keep separate entries. The file is $HPC_TUNING_CACHE, else
+// $XDG_CACHE_HOME/covalent-hpc/tuning, else ~/.cache/covalent-hpc/tuning.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TUNING_KEY_MAX 256
+#define TUNING_PATH_MAX 4096
+#define TUNING_LINE_MAX 512
+
+static inline double tuning_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static inline long tuning_cores(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? cores : 1;
+}
+
+static inline void tuning_host_key(char *key, size_t size) {
+    char line[TUNING_LINE_MAX];
+    char model[TUNING_KEY_MAX] = "unknown cpu";
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            char *colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon) {
+                snprintf(model, sizeof(model), "%s", colon + 2);
+                break;
+            }
+        }
+        fclose(f);
+    }
+    for (char *c = model; *c; c++) {
+        if (*c == '\t' || *c == '\n') {
+            *c = '\0';
+            break;
+        }
+    }
+    snprintf(key, size, "%s x%ld", model, tuning_cores());
+}
+
+static inline int tuning_cache_path(char *path, size_t size) {
+    const char *env = getenv("HPC_TUNING_CACHE");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (env && *env) {
+        return snprintf(path, size, "%s", env) < (int)size ? 0 : -1;
+    }
+    if (xdg && *xdg) {
+        return snprintf(path, size, "%s/covalent-hpc/tuning", xdg) < (int)size ? 0 : -1;
+    }
+    if (home && *home) {
+        return snprintf(path, size, "%s/.cache/covalent-hpc/tuning", home) < (int)size ? 0 : -1;
+    }
+    return -1;
+}
+
+// Creates the directories leading up to path.
+static inline void tuning_make_parents(const char *path) {
+    char dir[TUNING_PATH_MAX];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *c = dir + 1; *c; c++) {
+        if (*c == '/') {
+            *c = '\0';
+            mkdir(dir, 0755);
+            *c = '/';
+        }
+    }
+}
+
+// Returns 1 and sets *value when this host has an entry for name.
+static inline int tuning_lookup(const char *name, long *value) {
+    char path[TUNING_PATH_MAX], host[TUNING_KEY_MAX], line[TUNING_LINE_MAX];
+    size_t host_len, name_len = strlen(name);
+    int found = 0;
+    FILE *f;
+
+    if (tuning_cache_path(path, sizeof(path)) != 0 || !(f = fopen(path, "r"))) {
+        return 0;
+    }
+    tuning_host_key(host, sizeof(host));
+    host_len = strlen(host);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, host, host_len) == 0 && line[host_len] == '\t'
+            && strncmp(line + host_len + 1, name, name_len) == 0 && line[host_len + 1 + name_len] == '\t') {
+            *value = strtol(line + host_len + name_len + 2, NULL, 10);
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// Replaces this host's entry for name. The file is rewritten to a temporary and renamed into
+// place, so concurrent readers never see a partial profile. The temporary comes from mkstemp:
+// both modules store into the same file, possibly from one process at the same time, and must
+// never write through each other's temporary. Returns 0 on success.
+static inline int tuning_store(const char *name, long value) {
+    char path[TUNING_PATH_MAX], tmp[TUNING_PATH_MAX + 32], host[TUNING_KEY_MAX], line[TUNING_LINE_MAX];
+    char prefix[TUNING_KEY_MAX + TUNING_LINE_MAX];
+    size_t prefix_len;
+    FILE *in, *out;
+    int fd;
+
+    if (tuning_cache_path(path, sizeof(path)) != 0) {
+        return -1;
+    }
+    tuning_host_key(host, sizeof(host));
+    snprintf(prefix, sizeof(prefix), "%s\t%s\t", host, name);
+    prefix_len = strlen(prefix);
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    tuning_make_parents(path);
+    if ((fd = mkstemp(tmp)) < 0) {
+        return -1;
+    }
+    fchmod(fd, 0644);
+    if (!(out = fdopen(fd, "w"))) {
+        close(fd);
+        remove(tmp);
+        return -1;
+    }
+    if ((in = fopen(path, "r"))) {
+        while (fgets(line, sizeof(line), in)) {
+            if (strncmp(line, prefix, prefix_len) != 0) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s%ld\n", prefix, value);
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,411 @@
+#ifndef HPC_COMMON_WORKSTEAL_H
+#define HPC_COMMON_WORKSTEAL_H
+
+// Work-stealing fork/join scheduler shared by the native example modules (C and C++).
+//
+// A pool of (online cores - 1) workers is started on first use. Each worker owns a Chase-Lev
+// deque: it pushes and pops jobs at the bottom, idle workers steal from the top. Threads outside
+// the pool (the Python caller) push into a shared injection queue instead. Waiting on a group
+// never blocks: the waiter runs queued or stolen jobs until the group drains, so a parallel loop
+// started from inside another one just adds jobs to the same pool instead of starting threads,
+// and cannot deadlock on busy workers.
+//
+// Every module compiles its own copy of this code, but the pool state sits behind the ws_pool
+// pointer: Python modules call ws_share_pool() from their init function, so the first one to load
+// publishes its pool and the later ones adopt it, and the process keeps a single set of workers.
+// A worker's index lives in a pthread key of the shared state rather than a per-module thread
+// local, so a job from one module that spawns from a worker started by another still finds its deque.
+//
+// Jobs must not throw through this code; C++ callers catch in their job function.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define WS_DEQUE_SIZE 4096
+#define WS_MAX_WORKERS 256
+
+typedef struct ws_job {
+    void (*run)(struct ws_job *job);
+    long *pending;          // the group counter, decremented once run returns
+    struct ws_job *next;    // injection queue link
+} ws_job;
+
+// Jobs spawned into a group; ws_wait returns once all of them have run.
+typedef struct {
+    long pending;
+} ws_group;
+
+typedef struct {
+    long top;       // thieves take from here
+    long bottom;    // the owner pushes and pops here
+    ws_job *slots[WS_DEQUE_SIZE];
+} ws_deque;
+
+// Shared between modules through a capsule named WS_POOL_CAPSULE: change the name whenever this
+// layout changes, so modules built from different versions keep separate pools.
+typedef struct {
+    int started;
+    unsigned int workers;
+    ws_deque *deques;
+    pthread_mutex_t lock;       // guards the injection queue and sleeping
+    pthread_cond_t wake;
+    ws_job *inject_head, *inject_tail;
+    long injected;              // jobs in the injection queue, read without the lock
+    long epoch;                 // bumped on every push so sleepers do not miss work
+    long sleepers;
+    pthread_mutex_t start_lock;
+    int has_key;
+    pthread_key_t self;         // worker index + 1; unset (0) outside the pool
+} ws_pool_state;
+
+#define WS_POOL_CAPSULE "hpc.worksteal.pool.v1"
+
+static ws_pool_state ws_local_pool = {0, 0, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL,
+                                      0, 0, 0, PTHREAD_MUTEX_INITIALIZER, 0, 0};
+static ws_pool_state *ws_pool = &ws_local_pool;
+
+// Index of the calling pool worker, or -1 for threads outside the pool. The key is created before
+// the first worker, so no thread is a worker while it is missing.
+static inline int ws_self(void) {
+    if (!__atomic_load_n(&ws_pool->has_key, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    return (int)(intptr_t)pthread_getspecific(ws_pool->self) - 1;
+}
+
+// Fixed capacity: a push onto a full deque fails and the caller runs the job itself.
+static inline int ws_deque_push(ws_deque *d, ws_job *job) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+    if (b - t >= WS_DEQUE_SIZE) {
+        return 0;
+    }
+    __atomic_store_n(&d->slots[b & (WS_DEQUE_SIZE - 1)], job, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static inline ws_job *ws_deque_pop(ws_deque *d) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    long t;
+    ws_job *job = NULL;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t <= b) {
+        job = __atomic_load_n(&d->slots[b & (WS_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            // Last job: race the thieves for it.
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                job = NULL;
+            }
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return job;
+}
+
+static inline ws_job *ws_deque_steal(ws_deque *d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    long b;
+    ws_job *job;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    job = __atomic_load_n(&d->slots[t & (WS_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return job;
+}
+
+static inline void ws_notify(void) {
+    __atomic_add_fetch(&ws_pool->epoch, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ws_pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&ws_pool->lock);
+        pthread_cond_signal(&ws_pool->wake);
+        pthread_mutex_unlock(&ws_pool->lock);
+    }
+}
+
+static inline void ws_inject(ws_job *job) {
+    pthread_mutex_lock(&ws_pool->lock);
+    job->next = NULL;
+    if (ws_pool->inject_tail) {
+        ws_pool->inject_tail->next = job;
+    } else {
+        ws_pool->inject_head = job;
+    }
+    ws_pool->inject_tail = job;
+    __atomic_add_fetch(&ws_pool->injected, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ws_pool->lock);
+}
+
+static inline ws_job *ws_take_injected(void) {
+    ws_job *job;
+
+    if (__atomic_load_n(&ws_pool->injected, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&ws_pool->lock);
+    job = ws_pool->inject_head;
+    if (job) {
+        ws_pool->inject_head = job->next;
+        if (!ws_pool->inject_head) ws_pool->inject_tail = NULL;
+        __atomic_sub_fetch(&ws_pool->injected, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ws_pool->lock);
+    return job;
+}
+
+// Own deque first (newest job, still warm in cache), then the injection queue, then the oldest
+// job of the other workers starting from a rotating victim.
+static inline ws_job *ws_find(unsigned int *victim) {
+    ws_job *job = NULL;
+    unsigned int n = __atomic_load_n(&ws_pool->workers, __ATOMIC_ACQUIRE);
+    int self = ws_self();
+
+    if (self >= 0) {
+        job = ws_deque_pop(&ws_pool->deques[self]);
+    }
+    if (!job) {
+        job = ws_take_injected();
+    }
+    for (unsigned int k = 0; !job && k < n; k++) {
+        unsigned int v = (*victim + k) % n;
+        if ((int)v != self) {
+            job = ws_deque_steal(&ws_pool->deques[v]);
+            if (job) *victim = v;
+        }
+    }
+    return job;
+}
+
+static inline void ws_execute(ws_job *job) {
+    long *pending = job->pending;
+
+    job->run(job);
+    // The job may live on the spawner's stack, so it is not touched after this.
+    __atomic_sub_fetch(pending, 1, __ATOMIC_RELEASE);
+}
+
+static inline void *ws_worker_main(void *arg) {
+    unsigned int victim = (unsigned int)(uintptr_t)arg + 1;
+
+    pthread_setspecific(ws_pool->self, (void *)((uintptr_t)arg + 1));
+    for (;;) {
+        long epoch = __atomic_load_n(&ws_pool->epoch, __ATOMIC_SEQ_CST);
+        ws_job *job = ws_find(&victim);
+        if (job) {
+            ws_execute(job);
+            continue;
+        }
+        for (int spin = 0; spin < 64 && !job; spin++) {
+            sched_yield();
+            job = ws_find(&victim);
+        }
+        if (job) {
+            ws_execute(job);
+            continue;
+        }
+        pthread_mutex_lock(&ws_pool->lock);
+        __atomic_add_fetch(&ws_pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&ws_pool->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            pthread_cond_wait(&ws_pool->wake, &ws_pool->lock);
+        }
+        __atomic_sub_fetch(&ws_pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&ws_pool->lock);
+    }
+    return NULL;
+}
+
+// A forked child has none of the parent's workers; it starts a fresh pool on first use. Every
+// module sharing the pool may register this, and running it twice is harmless.
+static inline void ws_after_fork(void) {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+    if (ws_pool->has_key) {
+        pthread_setspecific(ws_pool->self, NULL);
+    }
+    ws_pool->started = 0;
+    ws_pool->workers = 0;
+    ws_pool->deques = NULL;
+    ws_pool->lock = lock;
+    ws_pool->wake = wake;
+    ws_pool->start_lock = lock;
+    ws_pool->inject_head = ws_pool->inject_tail = NULL;
+    ws_pool->injected = ws_pool->sleepers = 0;
+}
+
+static inline void ws_start(void) {
+    long cores;
+    unsigned int workers = 0;
+
+    if (__atomic_load_n(&ws_pool->started, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&ws_pool->start_lock);
+    if (!ws_pool->started) {
+        static int registered = 0;
+        if (!registered) {
+            pthread_atfork(NULL, NULL, ws_after_fork);
+            registered = 1;
+        }
+        if (!ws_pool->has_key && pthread_key_create(&ws_pool->self, NULL) == 0) {
+            __atomic_store_n(&ws_pool->has_key, 1, __ATOMIC_RELEASE);
+        }
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        cores = cores > WS_MAX_WORKERS ? WS_MAX_WORKERS : cores;
+        // Without a key no thread could tell it is a worker, so run everything on the callers.
+        cores = ws_pool->has_key ? cores : 1;
+        ws_pool->deques = (ws_deque *)calloc(cores > 1 ? (size_t)cores - 1 : 1, sizeof(ws_deque));
+        for (long w = 0; ws_pool->deques && w + 1 < cores; w++) {
+            pthread_t handle;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            // Publish the count before the thread can look at the other deques.
+            __atomic_store_n(&ws_pool->workers, workers + 1, __ATOMIC_RELEASE);
+            if (pthread_create(&handle, &attr, ws_worker_main, (void *)(uintptr_t)w) != 0) {
+                __atomic_store_n(&ws_pool->workers, workers, __ATOMIC_RELEASE);
+                pthread_attr_destroy(&attr);
+                break;
+            }
+            pthread_attr_destroy(&attr);
+            workers++;
+        }
+        __atomic_store_n(&ws_pool->started, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ws_pool->start_lock);
+}
+
+// Threads that can run jobs at once: the pool workers plus the caller.
+static inline unsigned int ws_concurrency(void) {
+    ws_start();
+    return __atomic_load_n(&ws_pool->workers, __ATOMIC_ACQUIRE) + 1;
+}
+
+// Queue job in group g. It runs on this thread or any worker before ws_wait(g) returns.
+static inline void ws_spawn(ws_group *g, ws_job *job) {
+    int self;
+
+    ws_start();
+    self = ws_self();
+    job->pending = &g->pending;
+    __atomic_add_fetch(&g->pending, 1, __ATOMIC_RELAXED);
+    if (self >= 0) {
+        if (!ws_deque_push(&ws_pool->deques[self], job)) {
+            ws_execute(job);
+            return;
+        }
+    } else {
+        ws_inject(job);
+    }
+    ws_notify();
+}
+
+// Run jobs (this group's or anyone's) until every job spawned in g has finished.
+static inline void ws_wait(ws_group *g) {
+    int self = ws_self();
+    unsigned int victim = self >= 0 ? (unsigned int)self + 1 : 0;
+    int idle = 0;
+
+    while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE) > 0) {
+        ws_job *job = ws_find(&victim);
+        if (job) {
+            ws_execute(job);
+            idle = 0;
+        } else if (++idle > 16) {
+            sched_yield();
+        }
+    }
+}
+
+// ws_parallel_for: run fn(ctx, t) for every t in [0, tasks). The range is split in halves, one
+// half spawned and the other kept, so thieves take the largest remaining pieces.
+typedef struct {
+    void (*fn)(void *ctx, size_t t);
+    void *ctx;
+} ws_loop;
+
+typedef struct {
+    ws_job job;
+    const ws_loop *loop;
+    size_t begin, end;
+} ws_range_job;
+
+static inline void ws_run_range(const ws_loop *loop, size_t begin, size_t end);
+
+static inline void ws_range_entry(ws_job *job) {
+    ws_range_job *r = (ws_range_job *)job;
+    ws_run_range(r->loop, r->begin, r->end);
+}
+
+static inline void ws_run_range(const ws_loop *loop, size_t begin, size_t end) {
+    ws_range_job halves[64];
+    ws_group g = {0};
+    int k = 0;
+
+    while (end - begin > 1) {
+        size_t mid = begin + (end - begin) / 2;
+        halves[k].job.run = ws_range_entry;
+        halves[k].loop = loop;
+        halves[k].begin = mid;
+        halves[k].end = end;
+        ws_spawn(&g, &halves[k].job);
+        k++;
+        end = mid;
+    }
+    if (begin < end) {
+        loop->fn(loop->ctx, begin);
+    }
+    ws_wait(&g);
+}
+
+static inline void ws_parallel_for(size_t tasks, void (*fn)(void *ctx, size_t t), void *ctx) {
+    ws_loop loop = {fn, ctx};
+
+    if (tasks == 1) {
+        fn(ctx, 0);
+    } else if (tasks > 1) {
+        ws_run_range(&loop, 0, tasks);
+    }
+}
+
+#ifdef Py_PYTHON_H
+// Call from module init, before any parallel work, with the GIL held. The pool lives in sys under
+// a versioned capsule: adopt it if an earlier module published one, otherwise publish this
+// module's. Extension modules are never unloaded, so the publishing module's pool outlives every
+// user. Returns -1 with a Python error set on failure.
+static inline int ws_share_pool(void) {
+    PyObject *capsule = PySys_GetObject("_hpc_worksteal_pool");
+    int rc;
+
+    if (capsule && PyCapsule_IsValid(capsule, WS_POOL_CAPSULE)) {
+        ws_pool = (ws_pool_state *)PyCapsule_GetPointer(capsule, WS_POOL_CAPSULE);
+        return 0;
+    }
+    capsule = PyCapsule_New(ws_pool, WS_POOL_CAPSULE, NULL);
+    if (!capsule) {
+        return -1;
+    }
+    rc = PySys_SetObject("_hpc_worksteal_pool", capsule);
+    Py_DECREF(capsule);
+    return rc;
+}
+#endif
+
+#endif
@@ -1,42 +1,522 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "stdio.h"
+#include "coalesce.h"
+#include "tuning.h"
+#include "worksteal.h"
+
+// Partitions per block in reproducible mode. Blocks are fixed, so their sums and the pairwise
+// tree that combines them do not depend on how many threads computed them.
+#define PI_BLOCK 65536
+#define PI_MAX_THREADS 256
 
-static PyObject* compute_pi(PyObject *self, PyObject *args) {
+typedef struct {
     unsigned int partitions;
+    unsigned int thread, threads;
+    double dh;
+    double *block_sums;    // reproducible mode: one entry per block
+    double sum;            // fast mode: this thread's contiguous range
+} pi_task;
 
+static double pi_range(unsigned int begin, unsigned int end, double dh) {
     double area = 0.0;
-    double dh;
 
-    if (!PyArg_ParseTuple(args, "I", &partitions)) {
-        return NULL;
+    for (unsigned int i = begin; i < end; i++) {
+        double x = dh * (i - 0.5);
+        area += (4.0/(1.0 + x*x));
+    }
+    return area;
+}
+
+static double tree_sum(const double *v, size_t n) {
+    if (n == 0) {
+        return 0.0;
     }
+    if (n == 1) {
+        return v[0];
+    }
+    return tree_sum(v, n / 2) + tree_sum(v + n / 2, n - n / 2);
+}
 
-    dh = 1.0/partitions;
+static void pi_worker(void *arg, size_t t) {
+    pi_task *task = (pi_task*)arg + t;
 
-    for (int i = 0; i < partitions; i++) {
-        double x = dh * (i - 0.5);
-        area += (4.0/(1.0 + x*x));
+    if (task->block_sums) {
+        // 64-bit block arithmetic: partitions + PI_BLOCK - 1 wraps in unsigned int near UINT_MAX.
+        size_t blocks = ((size_t)task->partitions + PI_BLOCK - 1) / PI_BLOCK;
+        for (size_t b = task->thread; b < blocks; b += task->threads) {
+            size_t begin = b * PI_BLOCK;
+            size_t end = task->partitions - begin < PI_BLOCK ? task->partitions : begin + PI_BLOCK;
+            task->block_sums[b] = pi_range((unsigned int)begin, (unsigned int)end, task->dh);
+        }
+    } else {
+        unsigned long long step = ((unsigned long long)task->partitions + task->threads - 1) / task->threads;
+        unsigned long long begin = step * task->thread, end = begin + step;
+        if (begin > task->partitions) begin = task->partitions;
+        if (end > task->partitions) end = task->partitions;
+        task->sum = pi_range((unsigned int)begin, (unsigned int)end, task->dh);
+    }
+}
+
+// Thread count and the fewest partitions worth handing a thread: the host's cached profile (see
+// common/tuning.h) from the first call, else defaults until retune() calibrates. Kept in the
+// module state; `lock` guards the fields and is never held while calling into Python, so
+// compute_pi can run from many threads without the GIL.
+typedef struct {
+    pthread_mutex_t lock;
+    int ready;
+    const char *source;
+    unsigned int threads;
+    unsigned int min_partitions;
+    co_queue batcher;           // small single-threaded calls, when batching is enabled
+    double import_seconds;      // time spent in pi_exec
+    double ready_time;          // when pi_exec finished
+} pi_state;
+
+static pi_state* pi_get_state(PyObject *module) {
+    return (pi_state*)PyModule_GetState(module);
+}
+
+// Takes the tuning lock; waits with the GIL released so a thread calibrating without it is
+// never blocked by a waiter that holds it.
+static void pi_lock(pi_state *st) {
+    if (pthread_mutex_trylock(&st->lock) != 0) {
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&st->lock);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static void pi_unlock(pi_state *st) {
+    pthread_mutex_unlock(&st->lock);
+}
+
+// Callers hold the tuning lock.
+static unsigned int pi_threads(const pi_state *st, unsigned int partitions) {
+    unsigned int threads = st->threads;
+    unsigned long long useful = partitions / st->min_partitions + 1ULL;
+
+    if (threads == 0) {
+        long cores = tuning_cores();
+        threads = cores > 0 ? (unsigned int)cores : 1;
+    }
+    if (threads > PI_MAX_THREADS) threads = PI_MAX_THREADS;
+    return threads < useful ? threads : (unsigned int)useful;
+}
+
+// Returns -1 when the block sums cannot be allocated.
+static int pi_compute(unsigned int partitions, unsigned int threads, int reproducible, double *result) {
+    pi_task tasks[PI_MAX_THREADS];
+    size_t blocks = ((size_t)partitions + PI_BLOCK - 1) / PI_BLOCK;
+    double *block_sums = NULL;
+    double dh = 1.0/partitions;
+    double area = 0.0;
+
+    if (reproducible) {
+        block_sums = malloc((blocks ? blocks : 1) * sizeof(double));
+        if (!block_sums) {
+            return -1;
+        }
+    }
+
+    for (unsigned int t = 0; t < threads; t++) {
+        pi_task task = {partitions, t, threads, dh, block_sums, 0.0};
+        tasks[t] = task;
+    }
+    // One task per share on the shared work-stealing pool (common/worksteal.h).
+    ws_parallel_for(threads, pi_worker, tasks);
+
+    if (reproducible) {
+        area = tree_sum(block_sums, blocks);
+        free(block_sums);
+    } else {
+        for (unsigned int t = 0; t < threads; t++) {
+            area += tasks[t].sum;
+        }
     }
 
     // pi approximation
-    return PyFloat_FromDouble(area*dh);
+    *result = area*dh;
+    return 0;
+}
+
+// One coalesced compute_pi call.
+typedef struct {
+    unsigned int partitions;
+    unsigned int threads;
+    int reproducible;
+    int status;
+    double result;
+} pi_request;
+
+static void pi_batch_entry(void *arg, size_t t) {
+    pi_request *req = ((pi_request**)arg)[t];
+
+    req->status = pi_compute(req->partitions, req->threads, req->reproducible, &req->result);
+}
+
+// Runs a whole batch as one parallel loop over its requests.
+static void pi_run_batch(co_request *batch, size_t count, void *ctx) {
+    pi_request **items = malloc(count * sizeof(pi_request*));
+    size_t i = 0;
+
+    (void)ctx;
+    if (!items) {
+        for (co_request *r = batch; r; r = r->next) {
+            pi_batch_entry(&r->payload, 0);
+        }
+        return;
+    }
+    for (co_request *r = batch; r; r = r->next) {
+        items[i++] = (pi_request*)r->payload;
+    }
+    ws_parallel_for(count, pi_batch_entry, items);
+    free(items);
+}
+
+static void pi_idle(void *arg, size_t t) {
+    (void)arg;
+    (void)t;
+}
+
+static double pi_time(const pi_state *st, unsigned int partitions, int reproducible) {
+    double best = 1e300, pi;
+
+    for (int rep = 0; rep < 3; rep++) {
+        double start = tuning_now();
+        if (pi_compute(partitions, pi_threads(st, partitions), reproducible, &pi) != 0) {
+            return 1e300;
+        }
+        if (tuning_now() - start < best) best = tuning_now() - start;
+    }
+    return best;
+}
+
+// Measures the cost of handing a share to a pool worker against per-partition cost to size the
+// smallest useful share, then tries a few thread counts on a large problem. Callers hold the
+// tuning lock.
+static void pi_calibrate(pi_state *st) {
+    long cores = tuning_cores();
+    unsigned int candidates[3];
+    double spawn = 0.0, per_partition, best = 1e300, start;
+
+    for (int rep = 0; rep < 8; rep++) {
+        start = tuning_now();
+        ws_parallel_for(2, pi_idle, NULL);
+        spawn += (tuning_now() - start) / 8;
+    }
+    st->threads = 1;
+    per_partition = pi_time(st, 1 << 20, 0) / (1 << 20);
+    st->min_partitions = PI_BLOCK;
+    if (per_partition > 0 && 4 * spawn / per_partition > PI_BLOCK) {
+        double share = 4 * spawn / per_partition;
+        st->min_partitions = share < 1e9 ? (unsigned int)share : 1000000000u;
+    }
+
+    candidates[0] = 1;
+    candidates[1] = cores > 1 ? (unsigned int)(cores / 2) : 1;
+    candidates[2] = cores > 0 ? (unsigned int)cores : 1;
+    for (int c = 0; c < 3; c++) {
+        unsigned int chosen = st->threads;
+        double t;
+        st->threads = candidates[c];
+        t = pi_time(st, 1 << 24, 0);
+        if (t < best) {
+            best = t;
+        } else {
+            st->threads = chosen;
+        }
+    }
+    st->source = "calibrated";
+    st->ready = 1;
+    tuning_store("cpiapprox.threads", (long)st->threads);
+    tuning_store("cpiapprox.min_partitions", (long)st->min_partitions);
+}
+
+// Callers hold the tuning lock. Loads this host's cached profile, if any; calibration only runs
+// through retune(), so the first call of a fresh process stays cheap.
+static void pi_ensure_tuned(pi_state *st) {
+    const char *mode = getenv("HPC_TUNING");
+    long threads, min_partitions;
+
+    if (st->ready) {
+        return;
+    }
+    st->ready = 1;
+    if (mode && strcmp(mode, "off") == 0) {
+        return;
+    }
+    if (tuning_lookup("cpiapprox.threads", &threads) && tuning_lookup("cpiapprox.min_partitions", &min_partitions)
+        && threads >= 0 && min_partitions > 0 && min_partitions <= 1000000000L) {
+        st->threads = (unsigned int)threads;
+        st->min_partitions = (unsigned int)min_partitions;
+        st->source = "cache";
+    }
+}
+
+static PyObject* compute_pi(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"partitions", "reproducible", NULL};
+    pi_state *st = pi_get_state(self);
+    unsigned int partitions;
+    int reproducible = 0;
+    unsigned int threads;
+    int status;
+    double pi;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "I|p", keywords, &partitions, &reproducible)) {
+        return NULL;
+    }
+
+    pi_lock(st);
+    pi_ensure_tuned(st);
+    threads = pi_threads(st, partitions);
+    pi_unlock(st);
+    Py_BEGIN_ALLOW_THREADS
+    if (threads == 1 && co_enabled(&st->batcher)) {
+        pi_request item = {partitions, threads, reproducible, 0, 0.0};
+        co_request req = {NULL, &item, 0};
+        co_submit(&st->batcher, &req);
+        status = item.status;
+        pi = item.result;
+    } else {
+        status = pi_compute(partitions, threads, reproducible, &pi);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (status != 0) {
+        return PyErr_NoMemory();
+    }
+    return PyFloat_FromDouble(pi);
+}
+
+// The tuning fields of the module state, copied out under the lock. The state itself holds the
+// mutex and the batching queue and is never copied.
+typedef struct {
+    const char *source;
+    unsigned int threads;
+    unsigned int min_partitions;
+} pi_tuning;
+
+// Callers hold the tuning lock.
+static pi_tuning pi_snapshot(const pi_state *st) {
+    pi_tuning snapshot = {st->source, st->threads, st->min_partitions};
+    return snapshot;
+}
+
+// Builds the dict from a snapshot taken by the caller under the tuning lock.
+static PyObject* tuning_dict(pi_tuning snapshot) {
+    char host[256];
+    long cores = tuning_cores();
+
+    tuning_host_key(host, sizeof(host));
+    return Py_BuildValue("{s:s,s:s,s:I,s:I}", "host", host, "source", snapshot.source,
+                         "threads", snapshot.threads ? snapshot.threads : (unsigned int)(cores > 0 ? cores : 1),
+                         "min_partitions", snapshot.min_partitions);
+}
+
+static PyObject* tuning(PyObject *self, PyObject *args) {
+    pi_state *st = pi_get_state(self);
+    pi_tuning snapshot;
+
+    pi_lock(st);
+    pi_ensure_tuned(st);
+    snapshot = pi_snapshot(st);
+    pi_unlock(st);
+    return tuning_dict(snapshot);
+}
+
+static PyObject* set_tuning(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"threads", "min_partitions", "persist", NULL};
+    pi_state *st = pi_get_state(self);
+    pi_tuning snapshot;
+    PyObject *threads = Py_None, *min_partitions = Py_None;
+    int persist = 0;
+    unsigned long thread_value = 0, partition_value = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOp", keywords, &threads, &min_partitions, &persist)) {
+        return NULL;
+    }
+    if (threads != Py_None) {
+        thread_value = PyLong_AsUnsignedLong(threads);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
+    if (min_partitions != Py_None) {
+        partition_value = PyLong_AsUnsignedLong(min_partitions);
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (partition_value == 0 || partition_value > 1000000000UL) {
+            PyErr_SetString(PyExc_ValueError, "min_partitions must be between 1 and 1e9");
+            return NULL;
+        }
+    }
+
+    pi_lock(st);
+    pi_ensure_tuned(st);
+    if (threads != Py_None) {
+        st->threads = thread_value > PI_MAX_THREADS ? PI_MAX_THREADS : (unsigned int)thread_value;
+    }
+    if (min_partitions != Py_None) {
+        st->min_partitions = (unsigned int)partition_value;
+    }
+    st->source = "override";
+    if (persist) {
+        tuning_store("cpiapprox.threads", (long)st->threads);
+        tuning_store("cpiapprox.min_partitions", (long)st->min_partitions);
+    }
+    snapshot = pi_snapshot(st);
+    pi_unlock(st);
+    return tuning_dict(snapshot);
+}
+
+static PyObject* retune(PyObject *self, PyObject *args) {
+    pi_state *st = pi_get_state(self);
+    pi_tuning snapshot;
+
+    pi_lock(st);
+    Py_BEGIN_ALLOW_THREADS
+    pi_calibrate(st);
+    Py_END_ALLOW_THREADS
+    snapshot = pi_snapshot(st);
+    pi_unlock(st);
+    return tuning_dict(snapshot);
+}
+
+static PyObject* batching_dict(pi_state *st) {
+    co_queue snapshot;
+
+    co_snapshot(&st->batcher, &snapshot);
+    return Py_BuildValue("{s:O,s:d,s:n,s:K,s:K}", "enabled", snapshot.enabled ? Py_True : Py_False,
+                         "latency_us", snapshot.latency_ns / 1000.0, "max_batch", (Py_ssize_t)snapshot.max_batch,
+                         "batches", snapshot.batches, "requests", snapshot.requests);
+}
+
+static PyObject* batching(PyObject *self, PyObject *args) {
+    return batching_dict(pi_get_state(self));
+}
+
+static PyObject* set_batching(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"enabled", "latency_us", "max_batch", NULL};
+    pi_state *st = pi_get_state(self);
+    int enabled;
+    double latency_us = 20.0;
+    Py_ssize_t max_batch = 64;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "p|dn", keywords, &enabled, &latency_us, &max_batch)) {
+        return NULL;
+    }
+    if (latency_us < 0 || latency_us > 1e6 || max_batch < 1) {
+        PyErr_SetString(PyExc_ValueError, "latency_us must be between 0 and 1e6 and max_batch at least 1");
+        return NULL;
+    }
+    co_configure(&st->batcher, enabled, (long)(latency_us * 1000.0), (size_t)max_batch);
+    return batching_dict(st);
+}
+
+// When the dynamic loader ran the library constructors; the rest of the import cost is pi_exec.
+// The worker pool and the tuning both start on first use.
+static double pi_loaded;
+
+__attribute__((constructor)) static void pi_mark_loaded(void) {
+    pi_loaded = tuning_now();
+}
+
+static PyObject* diagnostics(PyObject *self, PyObject *args) {
+    pi_state *st = pi_get_state(self);
+    int started = __atomic_load_n(&ws_pool->started, __ATOMIC_ACQUIRE);
+    unsigned int threads = started ? __atomic_load_n(&ws_pool->workers, __ATOMIC_ACQUIRE) + 1 : 0;
+    int tuned;
+
+    pi_lock(st);
+    tuned = st->ready;
+    pi_unlock(st);
+    return Py_BuildValue("{s:d,s:d,s:O,s:I,s:O,s:O}", "import_ms", st->import_seconds * 1e3,
+                         "load_to_ready_ms", (st->ready_time - pi_loaded) * 1e3,
+                         "pool_started", started ? Py_True : Py_False, "pool_threads", threads,
+                         "tuned", tuned ? Py_True : Py_False,
+                         "batching", co_enabled(&st->batcher) ? Py_True : Py_False);
 }
 
 static PyMethodDef PiapproxMethods[] = {
-    {"compute_pi", compute_pi, METH_VARARGS, "compute an approximation to PI using Reimann integration"},
+    {"compute_pi", (PyCFunction)(void(*)(void))compute_pi, METH_VARARGS | METH_KEYWORDS,
+     "compute an approximation to PI using Reimann integration on all cores; reproducible=True gives "
+     "bit-identical results for any core count"},
+    {"tuning", tuning, METH_NOARGS, "thread settings for this host and where they came from"},
+    {"set_tuning", (PyCFunction)(void(*)(void))set_tuning, METH_VARARGS | METH_KEYWORDS,
+     "override the thread count or min_partitions; persist=True writes them to the per-host tuning cache"},
+    {"retune", retune, METH_NOARGS, "calibrate for this host and store the result in the per-host tuning cache"},
+    {"set_batching", (PyCFunction)(void(*)(void))set_batching, METH_VARARGS | METH_KEYWORDS,
+     "coalesce concurrent single-threaded compute_pi calls: each batch waits up to latency_us for up to "
+     "max_batch calls, then runs them as one parallel loop"},
+    {"batching", batching, METH_NOARGS, "batching settings and how many batches and calls went through it"},
+    {"diagnostics", diagnostics, METH_NOARGS,
+     "import time and which lazily started parts (worker pool, tuning, batching) are running"},
     {NULL, NULL, 0, NULL}
 };
 
+static int pi_exec(PyObject *module) {
+    pi_state *st = pi_get_state(module);
+    double start = tuning_now();
+
+    if (ws_share_pool() != 0) {
+        return -1;
+    }
+    if (pthread_mutex_init(&st->lock, NULL) != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "cannot initialize the tuning lock");
+        return -1;
+    }
+    st->ready = 0;
+    st->source = "default";
+    st->threads = 0;
+    st->min_partitions = PI_BLOCK;
+    co_init(&st->batcher, pi_run_batch, NULL);
+    st->ready_time = tuning_now();
+    st->import_seconds = st->ready_time - start;
+    return 0;
+}
+
+static void pi_free(void *module) {
+    pi_state *st = pi_get_state((PyObject*)module);
+
+    if (st) {
+        pthread_mutex_destroy(&st->lock);
+        co_destroy(&st->batcher);
+    }
+}
+
+// Multi-phase initialization: every interpreter that imports the module gets its own state, and
+// free-threaded builds (3.13+) are told the module does not need the GIL.
+static PyModuleDef_Slot pi_slots[] = {
+    {Py_mod_exec, pi_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
 static struct PyModuleDef cpiapprox = {
     PyModuleDef_HEAD_INIT,
     "cpiapprox",
     NULL,
-    -1,
-    PiapproxMethods
+    sizeof(pi_state),
+    PiapproxMethods,
+    pi_slots,
+    NULL,
+    NULL,
+    pi_free
 };
 
 PyMODINIT_FUNC PyInit_cpiapprox(void) {
-    return PyModule_Create(&cpiapprox);
+    return PyModuleDef_Init(&cpiapprox);
 }
@@ -1,7 +1,9 @@
 from distutils.core import setup, Extension
 
 cpiapprox = Extension('cpiapprox', sources=['main.c'],
-extra_compile_args=["-O3"])
+include_dirs=["../common"],
+extra_compile_args=["-O3", "-ffp-contract=off", "-pthread"],
+extra_link_args=["-pthread"])
 
 setup(name='cpiapprox', version='1.0',
     description='A approximation to PI',ext_modules=[cpiapprox])
\ No newline at end of file
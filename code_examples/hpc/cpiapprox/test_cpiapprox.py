@@ -0,0 +1,123 @@
+"""Behaviour tests for the cpiapprox module.
+
+Build the module in place first, then run from this directory:
+
+    python setup.py build_ext --inplace
+    python -m unittest test_cpiapprox
+"""
+
+import math
+import os
+import sys
+import tempfile
+import threading
+import unittest
+
+# Keep the tests off the user's tuning cache.
+os.environ["HPC_TUNING_CACHE"] = os.path.join(tempfile.mkdtemp(), "tuning")
+
+import cpiapprox  # noqa: E402
+
+
+class TuningTest(unittest.TestCase):
+    def test_first_call_does_not_calibrate(self):
+        cpiapprox.compute_pi(1000)
+        self.assertIn(cpiapprox.tuning()["source"], ("default", "override"))
+
+    def test_override(self):
+        got = cpiapprox.set_tuning(threads=2, min_partitions=1000)
+        self.assertEqual((got["source"], got["threads"], got["min_partitions"]), ("override", 2, 1000))
+        self.assertEqual(cpiapprox.tuning(), got)
+
+    def test_override_checks_min_partitions(self):
+        with self.assertRaises(ValueError):
+            cpiapprox.set_tuning(min_partitions=0)
+
+    def test_persist_writes_the_cache(self):
+        cpiapprox.set_tuning(threads=1, persist=True)
+        with open(os.environ["HPC_TUNING_CACHE"]) as f:
+            self.assertIn("cpiapprox.threads", f.read())
+
+    def test_retune(self):
+        got = cpiapprox.retune()
+        self.assertEqual(got["source"], "calibrated")
+        self.assertGreaterEqual(got["threads"], 1)
+
+
+class ComputePiTest(unittest.TestCase):
+    def test_close_to_pi(self):
+        self.assertAlmostEqual(cpiapprox.compute_pi(1 << 20), math.pi, delta=1e-5)
+
+    def test_reproducible_for_any_thread_count(self):
+        results = set()
+        for threads in (1, 3, 8):
+            cpiapprox.set_tuning(threads=threads, min_partitions=1)
+            results.add(cpiapprox.compute_pi(1 << 20, reproducible=True))
+        self.assertEqual(len(results), 1)
+
+    def test_near_the_partition_limit(self):
+        # partitions + block size - 1 no longer fits in 32 bits here
+        self.assertAlmostEqual(cpiapprox.compute_pi(2**32 - 2**16 + 1, reproducible=True), math.pi, delta=1e-8)
+
+
+class PoolTest(unittest.TestCase):
+    def test_pool_is_published_for_other_modules(self):
+        self.assertIn("hpc.worksteal.pool", repr(sys._hpc_worksteal_pool))
+
+
+class ConcurrencyTest(unittest.TestCase):
+    def test_calls_race_with_overrides(self):
+        want = cpiapprox.compute_pi(100000)
+        results, settings = [], []
+
+        def compute():
+            results.extend(cpiapprox.compute_pi(100000) for _ in range(20))
+
+        def override():
+            for threads in range(1, 21):
+                settings.append(cpiapprox.set_tuning(threads=threads % 4 + 1, min_partitions=1000))
+                settings.append(cpiapprox.tuning())
+
+        calls = [threading.Thread(target=compute) for _ in range(4)] + [threading.Thread(target=override)]
+        for t in calls:
+            t.start()
+        for t in calls:
+            t.join()
+        self.assertEqual(len(results), 80)
+        for got in results:
+            self.assertAlmostEqual(got, want, delta=1e-12)
+        self.assertTrue(all(d["source"] == "override" and d["min_partitions"] == 1000 for d in settings))
+
+
+class BatchingTest(unittest.TestCase):
+    def tearDown(self):
+        cpiapprox.set_batching(False)
+
+    def test_concurrent_calls_are_batched(self):
+        cpiapprox.set_tuning(threads=1)
+        before = cpiapprox.set_batching(True, latency_us=1000, max_batch=8)["requests"]
+        self.assertTrue(cpiapprox.batching()["enabled"])
+        results = []
+        calls = [threading.Thread(target=lambda: results.append(cpiapprox.compute_pi(10000))) for _ in range(8)]
+        for t in calls:
+            t.start()
+        for t in calls:
+            t.join()
+        self.assertEqual(len(set(results)), 1)
+        self.assertEqual(cpiapprox.batching()["requests"] - before, 8)
+
+    def test_settings_are_checked(self):
+        for kwargs in ({"latency_us": -1}, {"max_batch": 0}):
+            with self.assertRaises(ValueError):
+                cpiapprox.set_batching(True, **kwargs)
+
+
+class DiagnosticsTest(unittest.TestCase):
+    def test_diagnostics(self):
+        d = cpiapprox.diagnostics()
+        self.assertGreaterEqual(d["import_ms"], 0)
+        self.assertEqual(d["pool_threads"] > 0, d["pool_started"])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,386 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapping.h"
+#include "vector.h"
+
+// Arrow IPC stream and file formats for float64 columns, with just enough FlatBuffers to
+// write and read the Schema, RecordBatch and Footer tables (see Arrow's Message.fbs, Schema.fbs
+// and File.fbs). Reads map the file and return Vectors that point straight into the mapping.
+
+// Forward FlatBuffers writer: every table is preceded by its vtable and children are written
+// after their parent, so all offsets point forward as the format requires.
+class FbWriter {
+public:
+    std::vector<uint8_t> buf;
+
+    struct Field {
+        size_t size;
+        uint64_t value;
+        bool offset;
+    };
+    static Field scalar(size_t size, uint64_t value) { return {size, value, false}; }
+    static Field offset() { return {4, 0, true}; }
+    static Field absent() { return {0, 0, false}; }
+
+    void align(size_t a, size_t skew = 0) {
+        while ((buf.size() + skew) % a) buf.push_back(0);
+    }
+
+    template <typename T>
+    void put(T v) {
+        size_t at = buf.size();
+        buf.resize(at + sizeof(v));
+        std::memcpy(&buf[at], &v, sizeof(v));
+    }
+
+    // Writes a table and returns the positions of its fields (0 for absent ones); the first
+    // entry is the table itself, so callers can point offsets at it.
+    std::vector<size_t> table(const std::vector<Field>& fields) {
+        align(2);
+        size_t vt = buf.size();
+        buf.resize(vt + 4 + 2 * fields.size());
+        align(8, 4);
+        size_t start = buf.size();
+        put<int32_t>(int32_t(start - vt));
+        std::vector<size_t> pos(1, start);
+        for (const Field& f : fields) {
+            if (f.size == 0) {
+                pos.push_back(0);
+                continue;
+            }
+            align(f.size);
+            pos.push_back(buf.size());
+            buf.resize(buf.size() + f.size);
+            std::memcpy(&buf[pos.back()], &f.value, f.size);
+        }
+        uint16_t header[2] = {uint16_t(4 + 2 * fields.size()), uint16_t(buf.size() - start)};
+        std::memcpy(&buf[vt], header, sizeof(header));
+        for (size_t i = 0; i < fields.size(); i++) {
+            uint16_t rel = pos[i + 1] ? uint16_t(pos[i + 1] - start) : 0;
+            std::memcpy(&buf[vt + 4 + 2 * i], &rel, sizeof(rel));
+        }
+        return pos;
+    }
+
+    // Vector of `count` elements of `elem` bytes; returns its position (elements start 4 bytes later).
+    size_t vector(size_t count, size_t elem, const void* data = nullptr) {
+        align(std::min<size_t>(std::max<size_t>(elem, 4), 8), 4);
+        size_t at = buf.size();
+        put<uint32_t>(uint32_t(count));
+        buf.resize(at + 4 + count * elem);
+        if (data) std::memcpy(&buf[at + 4], data, count * elem);
+        return at;
+    }
+
+    size_t string(const std::string& s) {
+        align(4);
+        size_t at = buf.size();
+        put<uint32_t>(uint32_t(s.size()));
+        buf.insert(buf.end(), s.begin(), s.end());
+        buf.push_back(0);
+        return at;
+    }
+
+    void link(size_t field, size_t target) {
+        uint32_t rel = uint32_t(target - field);
+        std::memcpy(&buf[field], &rel, sizeof(rel));
+    }
+};
+
+// Bounds-checked FlatBuffers table reader.
+class FbTable {
+public:
+    FbTable(const uint8_t* base, size_t size, size_t pos) : base(base), size(size), pos(pos) {
+        int32_t soff = read<int32_t>(pos);
+        vt = size_t(int64_t(pos) - soff);
+        vt_size = read<uint16_t>(vt);
+    }
+
+    static FbTable root(const uint8_t* base, size_t size) {
+        FbTable probe(base, size);
+        return FbTable(base, size, probe.read<uint32_t>(0));
+    }
+
+    template <typename T>
+    T get(int id, T fallback = T()) const {
+        size_t at = field(id);
+        return at ? read<T>(at) : fallback;
+    }
+
+    bool has(int id) const { return field(id) != 0; }
+
+    FbTable table(int id) const {
+        size_t at = deref(id);
+        if (!at) throw std::runtime_error("missing Arrow metadata table");
+        return FbTable(base, size, at);
+    }
+
+    // Vector field: position of its first element and the element count.
+    std::pair<size_t, uint32_t> vector(int id) const {
+        size_t at = deref(id);
+        if (!at) return {0, 0};
+        uint32_t count = read<uint32_t>(at);
+        return {at + 4, count};
+    }
+
+    std::string string(int id) const {
+        auto v = vector(id);
+        check(v.first, v.second);
+        return std::string(reinterpret_cast<const char*>(base + v.first), v.second);
+    }
+
+    template <typename T>
+    T read(size_t at) const {
+        check(at, sizeof(T));
+        T v;
+        std::memcpy(&v, base + at, sizeof(v));
+        return v;
+    }
+
+    const uint8_t* base;
+    size_t size, pos;
+
+private:
+    size_t vt = 0, vt_size = 0;
+
+    FbTable(const uint8_t* base, size_t size) : base(base), size(size), pos(0) {}
+
+    void check(size_t at, size_t len) const {
+        if (at > size || len > size - at) throw std::runtime_error("corrupt Arrow metadata");
+    }
+
+    size_t field(int id) const {
+        size_t slot = 4 + 2 * size_t(id);
+        if (slot + 2 > vt_size) return 0;
+        uint16_t rel = read<uint16_t>(vt + slot);
+        return rel ? pos + rel : 0;
+    }
+
+    size_t deref(int id) const {
+        size_t at = field(id);
+        if (!at) return 0;
+        return at + read<uint32_t>(at);
+    }
+};
+
+namespace arrow_format {
+const int16_t metadata_v5 = 4;
+const uint8_t header_schema = 1, header_dictionary = 2, header_record_batch = 3;
+const uint8_t type_floating_point = 3;
+const int16_t precision_double = 2;
+const uint32_t continuation = 0xFFFFFFFF;
+const char magic[] = "ARROW1";
+}  // namespace arrow_format
+
+// Schema table with a single non-nullable float64 field; returns the table position.
+inline size_t write_schema(FbWriter& w, const std::string& name) {
+    using F = FbWriter;
+    auto schema = w.table({F::scalar(2, 0), F::offset()});
+    size_t fields = w.vector(1, 4);
+    w.link(schema[2], fields);
+    auto field = w.table({F::offset(), F::scalar(1, 0), F::scalar(1, arrow_format::type_floating_point), F::offset(),
+                          F::absent(), F::offset()});
+    w.link(fields + 4, field[0]);
+    w.link(field[1], w.string(name));
+    w.link(field[4], w.table({F::scalar(2, arrow_format::precision_double)})[0]);
+    w.link(field[6], w.vector(0, 4));
+    return schema[0];
+}
+
+// One encapsulated IPC message: metadata and body lengths as recorded in file footer blocks.
+struct ArrowBlock {
+    int64_t offset;
+    int32_t metadata;
+    int32_t pad;
+    int64_t body;
+};
+
+class ArrowWriter {
+public:
+    ArrowWriter(const std::string& path, const std::string& name, bool file_format)
+        : name(name), file_format(file_format) {
+        out = std::fopen(path.c_str(), "wb");
+        if (!out) throw std::runtime_error("cannot open " + path + " for writing");
+        if (file_format) write_raw("ARROW1\0\0", 8);
+        FbWriter w = message(arrow_format::header_schema, 0);
+        w.link(header_field, write_schema(w, name));
+        write_message(w);
+    }
+
+    ~ArrowWriter() {
+        if (out) std::fclose(out);
+    }
+
+    void write_batch(const Vector& v) {
+        using F = FbWriter;
+        int64_t bytes = int64_t(v.size() * sizeof(double));
+        int64_t body = (bytes + 63) / 64 * 64;
+        FbWriter w = message(arrow_format::header_record_batch, body);
+        auto batch = w.table({F::scalar(8, v.size()), F::offset(), F::offset()});
+        w.link(header_field, batch[0]);
+        int64_t node[2] = {int64_t(v.size()), 0};
+        w.link(batch[2], w.vector(1, sizeof(node), node));
+        int64_t buffers[4] = {0, 0, 0, bytes};
+        w.link(batch[3], w.vector(2, 2 * sizeof(int64_t), buffers));
+
+        ArrowBlock block = write_message(w);
+        block.body = body;
+        write_raw(v.data(), size_t(bytes));
+        static const char zeros[64] = {};
+        write_raw(zeros, size_t(body - bytes));
+        blocks.push_back(block);
+    }
+
+    void close() {
+        uint32_t eos[2] = {arrow_format::continuation, 0};
+        write_raw(eos, sizeof(eos));
+        if (file_format) {
+            using F = FbWriter;
+            FbWriter w;
+            w.put<uint32_t>(0);
+            auto footer = w.table({F::scalar(2, arrow_format::metadata_v5), F::offset(), F::offset(), F::offset()});
+            w.link(0, footer[0]);
+            w.link(footer[2], write_schema(w, name));
+            w.link(footer[3], w.vector(0, sizeof(ArrowBlock)));
+            w.link(footer[4], w.vector(blocks.size(), sizeof(ArrowBlock), blocks.data()));
+            write_raw(w.buf.data(), w.buf.size());
+            int32_t length = int32_t(w.buf.size());
+            write_raw(&length, sizeof(length));
+            write_raw(arrow_format::magic, 6);
+        }
+        if (std::fclose(out) != 0) {
+            out = nullptr;
+            throw std::runtime_error("failed to finish Arrow file");
+        }
+        out = nullptr;
+    }
+
+private:
+    std::string name;
+    bool file_format;
+    std::FILE* out = nullptr;
+    int64_t written = 0;
+    size_t header_field = 0;
+    std::vector<ArrowBlock> blocks;
+
+    void write_raw(const void* data, size_t n) {
+        if (n && std::fwrite(data, 1, n, out) != n) throw std::runtime_error("failed to write Arrow data");
+        written += int64_t(n);
+    }
+
+    FbWriter message(uint8_t header_type, int64_t body) {
+        using F = FbWriter;
+        FbWriter w;
+        w.put<uint32_t>(0);
+        auto msg = w.table({F::scalar(2, arrow_format::metadata_v5), F::scalar(1, header_type), F::offset(),
+                            F::scalar(8, uint64_t(body))});
+        w.link(0, msg[0]);
+        header_field = msg[3];
+        return w;
+    }
+
+    // Continuation marker, padded metadata length and metadata, keeping the body 8-byte aligned.
+    ArrowBlock write_message(FbWriter& w) {
+        while ((w.buf.size() + 8) % 8) w.buf.push_back(0);
+        ArrowBlock block = {written, int32_t(w.buf.size() + 8), 0, 0};
+        uint32_t prefix[2] = {arrow_format::continuation, uint32_t(w.buf.size())};
+        write_raw(prefix, sizeof(prefix));
+        write_raw(w.buf.data(), w.buf.size());
+        return block;
+    }
+};
+
+// Number of buffers a top-level field of this type contributes to each record batch.
+inline size_t arrow_buffer_count(uint8_t type) {
+    switch (type) {
+        case 1: return 0;                                           // Null
+        case 4: case 5: case 19: case 20: return 3;                 // (Large)Binary, (Large)Utf8
+        case 2: case 3: case 6: case 7: case 8: case 9: case 10:
+        case 11: case 15: case 18: return 2;                        // fixed width and Bool
+        default: throw std::runtime_error("nested Arrow columns are not supported");
+    }
+}
+
+// Every record batch of one float64 column, selected by name or else by index, as Vectors over
+// the mapped file. Both the stream and the file format are accepted.
+inline std::vector<Vector> read_arrow(const std::string& path, const std::string& column, size_t index) {
+    auto file = std::make_shared<MappedFile>(path);
+    const uint8_t* base = file->data;
+    size_t size = file->size, pos = 0;
+    if (size >= 8 && std::memcmp(base, arrow_format::magic, 6) == 0) pos = 8;
+
+    size_t node = 0, buffer = 0;
+    bool have_schema = false;
+    std::vector<Vector> out;
+    while (pos + 4 <= size) {
+        uint32_t length;
+        std::memcpy(&length, base + pos, 4);
+        pos += 4;
+        if (length == arrow_format::continuation) {
+            if (pos + 4 > size) break;
+            std::memcpy(&length, base + pos, 4);
+            pos += 4;
+        }
+        if (length == 0 || pos + length > size) break;
+        FbTable msg = FbTable::root(base + pos, length);
+        int64_t body_length = msg.get<int64_t>(3);
+        size_t body = pos + length;
+        if (body_length < 0 || size_t(body_length) > size - body) throw std::runtime_error("truncated Arrow message");
+        uint8_t kind = msg.get<uint8_t>(1);
+
+        if (kind == arrow_format::header_schema) {
+            FbTable schema = msg.table(2);
+            auto fields = schema.vector(1);
+            bool found = false;
+            for (uint32_t i = 0; i < fields.second && !found; i++) {
+                size_t at = fields.first + 4 * i;
+                FbTable field(schema.base, schema.size, at + schema.read<uint32_t>(at));
+                uint8_t type = field.get<uint8_t>(2);
+                found = column.empty() ? i == index : field.string(0) == column;
+                if (found) {
+                    if (type != arrow_format::type_floating_point
+                        || field.table(3).get<int16_t>(0) != arrow_format::precision_double) {
+                        throw std::runtime_error("Arrow column is not float64");
+                    }
+                } else {
+                    node++;
+                    buffer += arrow_buffer_count(type);
+                }
+            }
+            if (!found) throw std::runtime_error("Arrow column not found");
+            have_schema = true;
+        } else if (kind == arrow_format::header_record_batch) {
+            if (!have_schema) throw std::runtime_error("Arrow record batch before schema");
+            FbTable batch = msg.table(2);
+            if (batch.has(3)) throw std::runtime_error("compressed Arrow record batches are not supported");
+            auto nodes = batch.vector(1);
+            auto buffers = batch.vector(2);
+            if (node >= nodes.second || buffer + 1 >= buffers.second) throw std::runtime_error("corrupt Arrow record batch");
+            int64_t rows = batch.read<int64_t>(nodes.first + 16 * node);
+            int64_t nulls = batch.read<int64_t>(nodes.first + 16 * node + 8);
+            if (nulls != 0) throw std::runtime_error("Arrow column contains nulls");
+            int64_t offset = batch.read<int64_t>(buffers.first + 16 * (buffer + 1));
+            int64_t bytes = batch.read<int64_t>(buffers.first + 16 * (buffer + 1) + 8);
+            if (rows < 0 || rows > body_length / 8) throw std::runtime_error("corrupt Arrow row count");
+            // Every operand is now in [0, body_length], so none of the checks below can overflow.
+            if (offset < 0 || offset > body_length || bytes < rows * 8 || bytes > body_length - offset
+                || (body + size_t(offset)) % 8) {
+                throw std::runtime_error("corrupt Arrow value buffer");
+            }
+            auto storage = std::make_shared<MappedStorage>(file, base + body + offset, size_t(rows));
+            out.emplace_back(std::move(storage), 0, size_t(rows));
+        }
+        pos = body + size_t(body_length);
+    }
+    if (!have_schema) throw std::runtime_error("no Arrow schema found in " + path);
+    return out;
+}
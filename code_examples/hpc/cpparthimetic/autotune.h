@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "kernels.h"
+#include "storage.h"
+#include "tuning.h"
+
+// Thread count, chunk size, parallel threshold and store strategy for the elementwise kernels.
+// On first use a profile cached for this host (see common/tuning.h) is loaded if there is one;
+// otherwise the built-in defaults apply. The calibration sweep only runs when asked for through
+// retune(), so a fresh process never pays for it. HPC_TUNING=off ignores the cache. The thread
+// count here applies to the elementwise kernels only; the others follow worker_setting().
+//
+// Every kernel call reads the settings, so they are published as atomics and read without the
+// lock; the lock only serialises loading, calibration and overrides. A call racing with
+// set_tuning may see some fields old and some new, and any such mix is a valid setting.
+struct Autotuner {
+    std::mutex lock;
+    std::atomic<bool> ready{false};
+    std::atomic<size_t> threads{0}, grain{0}, threshold{0}, stream_min{0};
+    std::atomic<const char*> source{"default"};
+};
+
+inline Autotuner& autotuner() {
+    static Autotuner tuner;
+    return tuner;
+}
+
+inline double time_elementwise(const Vector& a, const Vector& b, Vector& c, const ElementwiseParams& p) {
+    double best = 1e300;
+    for (int rep = 0; rep < 3; rep++) {
+        double start = tuning_now();
+        elementwise_into(a, b, c, add_op, p);
+        best = std::min(best, tuning_now() - start);
+    }
+    return best;
+}
+
+// Coordinate sweep: threads, then chunk size, then store strategy, then the size from which
+// going parallel pays off.
+inline ElementwiseParams calibrate_elementwise() {
+    const size_t n = 1 << 21;
+    Vector a(std::make_shared<HeapStorage>(n), 0, n), b(std::make_shared<HeapStorage>(n), 0, n);
+    Vector c(std::make_shared<HeapStorage>(n), 0, n);
+    for (size_t i = 0; i < n; i++) {
+        a.data()[i] = double(i);
+        b.data()[i] = 1.0;
+        c.data()[i] = 0.0;
+    }
+
+    ElementwiseParams best;
+    best.threshold = 0;
+    size_t hw = hardware_workers();
+    double best_time = 1e300;
+    for (size_t threads : {size_t(1), std::max<size_t>(1, hw / 2), hw}) {
+        ElementwiseParams p = best;
+        p.threads = threads;
+        double t = time_elementwise(a, b, c, p);
+        if (t < best_time) {
+            best_time = t;
+            best.threads = threads;
+        }
+    }
+    for (size_t grain : {size_t(1) << 13, size_t(1) << 17}) {
+        ElementwiseParams p = best;
+        p.grain = grain;
+        double t = time_elementwise(a, b, c, p);
+        if (t < best_time) {
+            best_time = t;
+            best.grain = grain;
+        }
+    }
+    ElementwiseParams streaming = best;
+    streaming.stream_min = n / 2;
+    if (time_elementwise(a, b, c, streaming) < best_time) best.stream_min = n / 2;
+
+    best.threshold = n;
+    if (best.threads > 1) {
+        for (size_t size = 1 << 10; size < n; size *= 4) {
+            Vector sa = a.slice(0, size), sb = b.slice(0, size), sc = c.slice(0, size);
+            ElementwiseParams serial = best, parallel = best;
+            serial.threshold = size + 1;
+            parallel.threshold = 0;
+            parallel.grain = std::max<size_t>(1, std::min(best.grain, size / best.threads));
+            if (time_elementwise(sa, sb, sc, parallel) < time_elementwise(sa, sb, sc, serial)) {
+                best.threshold = size;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+inline void store_params(const ElementwiseParams& p) {
+    tuning_store("cpparthimetic.threads", long(p.threads));
+    tuning_store("cpparthimetic.grain", long(p.grain));
+    tuning_store("cpparthimetic.threshold", long(p.threshold));
+    tuning_store("cpparthimetic.stream_min", long(p.stream_min));
+}
+
+inline bool load_params(ElementwiseParams& p) {
+    long threads, grain, threshold, stream_min;
+    if (!tuning_lookup("cpparthimetic.threads", &threads) || !tuning_lookup("cpparthimetic.grain", &grain)
+        || !tuning_lookup("cpparthimetic.threshold", &threshold)
+        || !tuning_lookup("cpparthimetic.stream_min", &stream_min) || threads < 0 || grain <= 0 || threshold < 0
+        || stream_min < 0) {
+        return false;
+    }
+    p.threads = size_t(threads);
+    p.grain = size_t(grain);
+    p.threshold = size_t(threshold);
+    p.stream_min = size_t(stream_min);
+    return true;
+}
+
+// Caller holds the tuner lock.
+inline void apply_params(Autotuner& tuner, const ElementwiseParams& p, const char* source) {
+    tuner.threads.store(p.threads, std::memory_order_relaxed);
+    tuner.grain.store(p.grain, std::memory_order_relaxed);
+    tuner.threshold.store(p.threshold, std::memory_order_relaxed);
+    tuner.stream_min.store(p.stream_min, std::memory_order_relaxed);
+    tuner.source.store(source, std::memory_order_relaxed);
+    tuner.ready.store(true, std::memory_order_release);
+}
+
+inline ElementwiseParams tuned_params() {
+    Autotuner& tuner = autotuner();
+    if (!tuner.ready.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> guard(tuner.lock);
+        if (!tuner.ready.load(std::memory_order_relaxed)) {
+            const char* mode = std::getenv("HPC_TUNING");
+            ElementwiseParams p;
+            bool cached = !(mode && std::strcmp(mode, "off") == 0) && load_params(p);
+            apply_params(tuner, cached ? p : ElementwiseParams(), cached ? "cache" : "default");
+        }
+    }
+    ElementwiseParams p;
+    p.threads = tuner.threads.load(std::memory_order_relaxed);
+    p.grain = tuner.grain.load(std::memory_order_relaxed);
+    p.threshold = tuner.threshold.load(std::memory_order_relaxed);
+    p.stream_min = tuner.stream_min.load(std::memory_order_relaxed);
+    return p;
+}
+
+inline ElementwiseParams retune() {
+    Autotuner& tuner = autotuner();
+    std::lock_guard<std::mutex> guard(tuner.lock);
+    ElementwiseParams p = calibrate_elementwise();
+    store_params(p);
+    apply_params(tuner, p, "calibrated");
+    return p;
+}
+
+inline void override_params(const ElementwiseParams& p, bool persist) {
+    Autotuner& tuner = autotuner();
+    std::lock_guard<std::mutex> guard(tuner.lock);
+    if (persist) store_params(p);
+    apply_params(tuner, p, "override");
+}
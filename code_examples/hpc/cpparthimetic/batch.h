@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "autotune.h"
+#include "coalesce.h"
+#include "kernels.h"
+#include "parallel.h"
+
+// Opt-in micro-batching of small elementwise calls (see common/coalesce.h). Calls below the
+// parallel threshold would each run serially on their own thread; coalesced, a batch of them
+// runs as one parallel loop over its requests.
+
+struct BinaryRequest {
+    const double* a;
+    const double* b;
+    double* c;
+    size_t n;
+};
+
+inline void run_binary_batch(co_request* batch, size_t count, void* ctx) {
+    const BinaryOp& op = *static_cast<const BinaryOp*>(ctx);
+    auto run = [&](const BinaryRequest& r) { op.regular(r.a, r.b, r.c, r.n); };
+    // This runs inside co_submit, which must not unwind with followers still waiting.
+    try {
+        std::vector<const BinaryRequest*> items;
+        items.reserve(count);
+        size_t total = 0;
+        for (co_request* r = batch; r; r = r->next) {
+            items.push_back(static_cast<const BinaryRequest*>(r->payload));
+            total += items.back()->n;
+        }
+        ElementwiseParams p = tuned_params();
+        if (total < p.threshold) {
+            for (const BinaryRequest* r : items) run(*r);
+        } else {
+            parallel_invoke(items.size(), [&](size_t i) { run(*items[i]); }, p.threads);
+        }
+    } catch (...) {
+        for (co_request* r = batch; r; r = r->next) run(*static_cast<const BinaryRequest*>(r->payload));
+    }
+}
+
+// One queue per operation, so a batch only ever holds one kind of kernel.
+struct Batcher {
+    co_queue add, mul, div;
+
+    Batcher() {
+        co_init(&add, run_binary_batch, const_cast<BinaryOp*>(&add_op));
+        co_init(&mul, run_binary_batch, const_cast<BinaryOp*>(&mul_op));
+        co_init(&div, run_binary_batch, const_cast<BinaryOp*>(&div_op));
+    }
+
+    co_queue* queue(const BinaryOp& op) {
+        if (&op == &add_op) return &add;
+        if (&op == &mul_op) return &mul;
+        if (&op == &div_op) return &div;
+        return nullptr;
+    }
+};
+
+inline Batcher& batcher() {
+    static Batcher b;
+    return b;
+}
+
+// elementwise(), queued for batching when it is enabled and the call is small. Must be called
+// without the GIL.
+inline Vector elementwise_batched(const Vector& a, const Vector& b, const BinaryOp& op) {
+    ElementwiseParams p = tuned_params();
+    co_queue* q = batcher().queue(op);
+    if (!q || !co_enabled(q) || a.size() >= p.threshold) return elementwise(a, b, op, p);
+    if (a.size() != b.size()) throw std::invalid_argument("input vectors must have the same length");
+    Vector c(a.size());
+    BinaryRequest item{a.data(), b.data(), c.data(), a.size()};
+    co_request req{nullptr, &item, 0};
+    co_submit(q, &req);
+    return c;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "kernels.h"
+#include "masked.h"
+#include "parallel.h"
+#include "simd.h"
+
+// Packed bitmasks from comparisons and predicates: element i is bit i % 64 of word i / 64, the
+// layout the masked kernels read through Mask::bits, so a mask costs one bit per element instead
+// of a byte (or a Python bool). Bits past the length in the last word are always zero, which lets
+// counts and logic ops work on whole words.
+class Bitmask {
+public:
+    Bitmask() : len(0) {}
+    explicit Bitmask(size_t n) : words((n + 63) / 64), len(n) {}
+
+    uint64_t* data() { return words.data(); }
+    const uint64_t* data() const { return words.data(); }
+    size_t size() const { return len; }
+    size_t word_count() const { return words.size(); }
+    bool test(size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+    Mask mask() const { return {nullptr, words.data()}; }
+
+private:
+    std::vector<uint64_t> words;
+    size_t len;
+};
+
+// x - x is 0 for finite x and NaN for infinities and NaN; unlike std::isfinite it vectorizes.
+struct IsFinite {
+    bool operator()(double x) const { return x - x == 0; }
+};
+
+struct IsNan {
+    bool operator()(double x) const { return x != x; }
+};
+
+// |x - y| <= tol
+struct IsClose {
+    double tol;
+    bool operator()(double x, double y) const { return std::fabs(x - y) <= tol; }
+};
+
+// A comparison against a fixed right-hand side, for vector-scalar comparisons.
+template <typename Cmp>
+struct Against {
+    Cmp cmp;
+    double y;
+    bool operator()(double x) const { return cmp(x, y); }
+};
+
+// Gather the low bit of each of 64 bytes into one word, lowest byte first.
+inline uint64_t pack_bytes(const uint8_t* bytes) {
+    uint64_t word = 0;
+    for (unsigned k = 0; k < 64; k += 8) {
+        uint64_t x;
+        std::memcpy(&x, bytes + k, 8);
+        word |= ((x & 0x0101010101010101ULL) * 0x0102040810204080ULL >> 56) << k;
+    }
+    return word;
+}
+
+// out[w] holds pred(a[j], b[j]) for the 64 elements of word w. The predicate fills a byte per
+// element, which vectorizes as plain compares, and the bytes are then packed eight at a time.
+template <typename Pred>
+SIMD_CLONES void compare_words(const double* a, const double* b, uint64_t* out, size_t words, Pred pred) {
+    uint8_t flags[64];
+    for (size_t w = 0; w < words; w++) {
+        for (size_t j = 0; j < 64; j++) flags[j] = pred(a[64 * w + j], b[64 * w + j]);
+        out[w] = pack_bytes(flags);
+    }
+}
+
+template <typename Pred>
+SIMD_CLONES void predicate_words(const double* a, uint64_t* out, size_t words, Pred pred) {
+    uint8_t flags[64];
+    for (size_t w = 0; w < words; w++) {
+        for (size_t j = 0; j < 64; j++) flags[j] = pred(a[64 * w + j]);
+        out[w] = pack_bytes(flags);
+    }
+}
+
+// Whole words run in parallel; the last, partial word is filled bit by bit.
+template <typename Words, typename Tail>
+Bitmask build_bitmask(size_t n, const ElementwiseParams& p, Words&& words, Tail&& tail) {
+    Bitmask m(n);
+    size_t full = n / 64;
+    if (n < p.threshold) {
+        words(m.data(), 0, full);
+    } else {
+        parallel_for(full, std::max<size_t>(1, p.grain / 64), [&](size_t, size_t begin, size_t end) {
+            words(m.data(), begin, end);
+        }, p.threads);
+    }
+    uint64_t last = 0;
+    for (size_t i = 64 * full; i < n; i++) last |= uint64_t(tail(i)) << (i & 63);
+    if (n % 64) m.data()[full] = last;
+    return m;
+}
+
+// Bitmask of pred(a[i], b[i]).
+template <typename Pred>
+Bitmask compare(const double* a, const double* b, size_t n, Pred pred, const ElementwiseParams& p) {
+    return build_bitmask(n, p, [&](uint64_t* out, size_t begin, size_t end) {
+        compare_words(a + 64 * begin, b + 64 * begin, out + begin, end - begin, pred);
+    }, [&](size_t i) { return pred(a[i], b[i]); });
+}
+
+// Bitmask of pred(a[i]).
+template <typename Pred>
+Bitmask predicate(const double* a, size_t n, Pred pred, const ElementwiseParams& p) {
+    return build_bitmask(n, p, [&](uint64_t* out, size_t begin, size_t end) {
+        predicate_words(a + 64 * begin, out + begin, end - begin, pred);
+    }, [&](size_t i) { return pred(a[i]); });
+}
+
+SIMD_CLONES inline size_t count_bits(const uint64_t* words, size_t n) {
+    size_t count = 0;
+    for (size_t w = 0; w < n; w++) count += size_t(__builtin_popcountll(words[w]));
+    return count;
+}
+
+template <typename Op>
+SIMD_CLONES void logic_words(const uint64_t* a, const uint64_t* b, uint64_t* out, size_t n, Op op) {
+    for (size_t w = 0; w < n; w++) out[w] = op(a[w], b[w]);
+}
+
+// Elementwise and/or/xor of two masks of the same length.
+template <typename Op>
+Bitmask bitmask_logic(const Bitmask& a, const Bitmask& b, Op op) {
+    if (a.size() != b.size()) throw std::invalid_argument("bitmasks must have the same length");
+    Bitmask c(a.size());
+    logic_words(a.data(), b.data(), c.data(), a.word_count(), op);
+    return c;
+}
+
+inline Bitmask bitmask_not(const Bitmask& a) {
+    Bitmask c(a.size());
+    for (size_t w = 0; w < a.word_count(); w++) c.data()[w] = ~a.data()[w];
+    if (a.size() % 64) c.data()[a.word_count() - 1] &= (uint64_t(1) << (a.size() % 64)) - 1;
+    return c;
+}
+
+// Mask bits for the elements [64 w, min(64 w + 64, n)), lowest bit first; bits past n are zero.
+inline uint64_t mask_word(const Mask& m, size_t w, size_t n) {
+    size_t i = 64 * w;
+    uint64_t word = 0;
+    if (i + 64 <= n) {
+        if (m.bits) return m.bits[w];
+        for (unsigned k = 0; k < 64; k += 8) word |= uint64_t(mask8(m, i + k)) << k;
+        return word;
+    }
+    for (size_t j = i; j < n; j++) word |= uint64_t(mask_at(m, j)) << (j - i);
+    return word;
+}
+
+// Copy the elements of a whose mask bit is set to out, in order, and return how many there were.
+// Chunks count their set bits, a prefix sum gives each chunk its output offset, then every chunk
+// writes its elements independently.
+inline size_t compact(const double* a, const Mask& m, size_t n, double* out, const ElementwiseParams& p) {
+    size_t words = (n + 63) / 64, grain = std::max<size_t>(1, p.grain / 64);
+    size_t threads = n < p.threshold ? 1 : p.threads ? p.threads : num_workers();
+    size_t chunks = parallel_chunks(words, grain, threads);
+    std::vector<size_t> offset(chunks + 1, 0);
+    parallel_for(words, grain, [&](size_t c, size_t begin, size_t end) {
+        size_t count = 0;
+        for (size_t w = begin; w < end; w++) count += size_t(__builtin_popcountll(mask_word(m, w, n)));
+        offset[c + 1] = count;
+    }, threads);
+    for (size_t c = 0; c < chunks; c++) offset[c + 1] += offset[c];
+    parallel_for(words, grain, [&](size_t c, size_t begin, size_t end) {
+        double* o = out + offset[c];
+        for (size_t w = begin; w < end; w++) {
+            for (uint64_t k = mask_word(m, w, n); k; k &= k - 1) *o++ = a[64 * w + __builtin_ctzll(k)];
+        }
+    }, threads);
+    return offset[chunks];
+}
+
+// Number of set elements, for sizing the output of compact.
+inline size_t mask_count(const Mask& m, size_t n) {
+    size_t full = n / 64, count = 0;
+    if (m.bits) {
+        count = count_bits(m.bits, full);
+    } else {
+        for (size_t w = 0; w < full; w++) count += size_t(__builtin_popcountll(mask_word(m, w, n)));
+    }
+    if (n % 64) count += size_t(__builtin_popcountll(mask_word(m, full, n)));
+    return count;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bitmask.h"
+#include "caster.h"
+#include "masked.h"
+#include "vector.h"
+
+namespace py = pybind11;
+
+// True when the buffer's element type is T (any byte order prefix is ignored).
+template <typename T>
+bool format_is(const py::buffer_info& info) {
+    if (info.itemsize != (py::ssize_t) sizeof(T) || info.format.empty()) return false;
+    char f = info.format.back();
+    if (std::is_floating_point<T>::value) return f == (sizeof(T) == 8 ? 'd' : 'f');
+    if (std::is_same<T, bool>::value) return f == '?';
+    return std::strchr(std::is_signed<T>::value ? "bhilq" : "BHILQ?", f) != nullptr;
+}
+
+// A one dimensional, contiguous view of a Python buffer (numpy array, array.array, memoryview, ...).
+// Holds the buffer request open for as long as it lives.
+template <typename T>
+struct Span {
+    py::buffer_info info;
+    T* data;
+    size_t size;
+
+    Span(const py::buffer& b, const char* name, bool writable = false) : info(b.request(writable)) {
+        if (!format_is<T>(info)) {
+            throw py::type_error(std::string(name) + ": unsupported element type '" + info.format + "'");
+        }
+        if (info.ndim != 1 || (info.shape[0] > 1 && info.strides[0] != info.itemsize)) {
+            throw py::value_error(std::string(name) + ": expected a contiguous one dimensional buffer");
+        }
+        data = static_cast<T*>(info.ptr);
+        size = static_cast<size_t>(info.shape[0]);
+    }
+};
+
+// A one dimensional view of a Python buffer with any element stride: every other element,
+// a column of a 2-D array, or a reversed slice (negative stride).
+template <typename T>
+struct StridedSpan {
+    py::buffer_info info;
+    T* data;
+    size_t size;
+    ptrdiff_t stride;
+
+    StridedSpan(const py::buffer& b, const char* name, bool writable = false) : info(b.request(writable)) {
+        if (!format_is<T>(info)) {
+            throw py::type_error(std::string(name) + ": unsupported element type '" + info.format + "'");
+        }
+        if (info.ndim != 1 || info.strides[0] % info.itemsize != 0) {
+            throw py::value_error(std::string(name) + ": expected a one dimensional buffer of aligned elements");
+        }
+        data = static_cast<T*>(info.ptr);
+        size = static_cast<size_t>(info.shape[0]);
+        stride = info.strides[0] / info.itemsize;
+    }
+};
+
+// A where= mask for n elements: a Bitmask of length n, a bool or uint8 buffer with one entry per
+// element, or a uint64 buffer of packed bits (element i is bit i % 64 of word i / 64).
+struct MaskBuffer {
+    py::buffer_info info;
+    Mask mask;
+
+    MaskBuffer(const py::handle& where, size_t n, const char* name) {
+        if (py::isinstance<Bitmask>(where)) {
+            const Bitmask& bits = where.cast<const Bitmask&>();
+            if (bits.size() != n) throw py::value_error(std::string(name) + ": where must have one entry per element");
+            mask = bits.mask();
+            return;
+        }
+        if (!PyObject_CheckBuffer(where.ptr())) {
+            throw py::type_error(std::string(name) + ": where must be a Bitmask or a bool, uint8 or packed uint64 buffer");
+        }
+        info = py::reinterpret_borrow<py::buffer>(where).request();
+        if (info.ndim != 1 || (info.shape[0] > 1 && info.strides[0] != info.itemsize)) {
+            throw py::value_error(std::string(name) + ": where must be a contiguous one dimensional buffer");
+        }
+        size_t len = static_cast<size_t>(info.shape[0]);
+        char f = info.format.empty() ? 0 : info.format.back();
+        if (info.itemsize == 1 && (f == '?' || f == 'b' || f == 'B')) {
+            if (len != n) throw py::value_error(std::string(name) + ": where must have one entry per element");
+            mask = {static_cast<const uint8_t*>(info.ptr), nullptr};
+        } else if (format_is<uint64_t>(info)) {
+            if (len < (n + 63) / 64) throw py::value_error(std::string(name) + ": bitmask is too short");
+            mask = {nullptr, static_cast<const uint64_t*>(info.ptr)};
+        } else {
+            throw py::type_error(std::string(name) + ": where must be a Bitmask or a bool, uint8 or packed uint64 buffer");
+        }
+    }
+};
+
+// A one dimensional, contiguous complex128 buffer ('Zd'), viewed as interleaved (re, im) doubles.
+struct ComplexSpan {
+    py::buffer_info info;
+    double* data;
+    size_t size;
+
+    ComplexSpan(const py::buffer& b, const char* name) : info(b.request()) {
+        if (!is_complex128(info)) {
+            throw py::type_error(std::string(name) + ": unsupported element type '" + info.format + "'");
+        }
+        if (info.ndim != 1 || (info.shape[0] > 1 && info.strides[0] != info.itemsize)) {
+            throw py::value_error(std::string(name) + ": expected a contiguous one dimensional buffer");
+        }
+        data = static_cast<double*>(info.ptr);
+        size = static_cast<size_t>(info.shape[0]);
+    }
+
+    static bool is_complex128(const py::buffer_info& info) {
+        const std::string& f = info.format;
+        return info.itemsize == 16 && f.size() >= 2 && f.compare(f.size() - 2, 2, "Zd") == 0;
+    }
+};
+
+// Element format character of a buffer, used to dispatch between float64 and float32 kernels.
+inline char buffer_format(const py::buffer& b) {
+    py::buffer_info info = b.request();
+    return info.format.empty() ? 0 : info.format.back();
+}
+
+// A two dimensional, row-major view of a Python buffer whose rows may be padded (leading dimension ld).
+template <typename T>
+struct MatrixSpan {
+    py::buffer_info info;
+    T* data;
+    size_t rows, cols, ld;
+
+    MatrixSpan(const py::buffer& b, const char* name, bool writable = false) : info(b.request(writable)) {
+        if (!format_is<T>(info)) {
+            throw py::type_error(std::string(name) + ": unsupported element type '" + info.format + "'");
+        }
+        if (info.ndim != 2 || (info.shape[1] > 1 && info.strides[1] != info.itemsize)
+            || info.strides[0] % info.itemsize != 0 || info.strides[0] < info.shape[1] * info.itemsize) {
+            throw py::value_error(std::string(name) + ": expected a row-major two dimensional buffer");
+        }
+        data = static_cast<T*>(info.ptr);
+        rows = static_cast<size_t>(info.shape[0]);
+        cols = static_cast<size_t>(info.shape[1]);
+        ld = static_cast<size_t>(info.strides[0] / info.itemsize);
+    }
+};
+
+// Vector storage borrowed from a contiguous float64 Python buffer. Keeps the exporting object
+// alive and releases the buffer under the GIL, whichever thread drops the last view.
+struct PyBufferStorage : Storage {
+    std::unique_ptr<Span<double>> span;
+
+    PyBufferStorage(const py::buffer& b, const char* name) : span(new Span<double>(b, name)) {
+        data = span->data;
+        size = span->size;
+        readonly = span->info.readonly;
+    }
+    ~PyBufferStorage() override {
+        py::gil_scoped_acquire gil;
+        span.reset();
+    }
+};
+
+// A new Vector holding the elements of any sequence of numbers, through the list caster in
+// caster.h (included above so it is declared before this first use).
+inline Vector convert_vector(const py::handle& obj) {
+    std::vector<double> values = obj.cast<std::vector<double>>();
+    Vector v(values.size());
+    std::copy(values.begin(), values.end(), v.data());
+    return v;
+}
+
+// A Vector over any vector-like argument: Vectors are used as is, float64 buffers are viewed
+// without copying and other sequences are converted once.
+inline Vector as_vector(const py::handle& obj, const char* name) {
+    if (py::isinstance<Vector>(obj)) return obj.cast<Vector>();
+    if (PyObject_CheckBuffer(obj.ptr())) {
+        auto storage = std::make_shared<PyBufferStorage>(py::reinterpret_borrow<py::buffer>(obj), name);
+        size_t n = storage->size;
+        return Vector(std::move(storage), 0, n);
+    }
+    return convert_vector(obj);
+}
+
+// A Vector for an argument written in place: a Vector or a writable float64 buffer. Anything else
+// would be converted into a temporary copy and the writes lost, so it is rejected.
+inline Vector output_vector(const py::handle& obj, const char* name, const char* what) {
+    if (!py::isinstance<Vector>(obj) && !PyObject_CheckBuffer(obj.ptr())) {
+        throw py::type_error(std::string(name) + ": " + what + " must be a Vector or a writable float64 buffer");
+    }
+    Vector v = as_vector(obj, name);
+    if (v.readonly()) throw py::type_error(std::string(name) + ": " + what + " is read-only");
+    return v;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <vector>
+
+namespace pybind11 {
+namespace detail {
+
+// Replaces the generic stl.h caster for std::vector<double>. Lists and tuples are read straight
+// from their item arrays into a presized vector, taking the exact-float fast path per item, and
+// results are written into a presized list without intermediate Python calls.
+template <>
+struct type_caster<std::vector<double>> {
+    PYBIND11_TYPE_CASTER(std::vector<double>, const_name("List[float]"));
+
+    bool load(handle src, bool convert) {
+        if (!src || PyUnicode_Check(src.ptr()) || PyBytes_Check(src.ptr()) || !PySequence_Check(src.ptr())) {
+            return false;
+        }
+        object seq = reinterpret_steal<object>(PySequence_Fast(src.ptr(), ""));
+        if (!seq) {
+            PyErr_Clear();
+            return false;
+        }
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(seq.ptr());
+        PyObject** items = PySequence_Fast_ITEMS(seq.ptr());
+        value.resize(static_cast<size_t>(n));
+        double* out = value.data();
+        for (Py_ssize_t i = 0; i < n; i++) {
+            PyObject* item = items[i];
+            if (PyFloat_CheckExact(item)) {
+                out[i] = PyFloat_AS_DOUBLE(item);
+                continue;
+            }
+            if (!convert && !PyFloat_Check(item)) return false;
+            double v = PyFloat_AsDouble(item);
+            if (v == -1.0 && PyErr_Occurred()) {
+                PyErr_Clear();
+                return false;
+            }
+            out[i] = v;
+        }
+        return true;
+    }
+
+    static handle cast(const std::vector<double>& src, return_value_policy, handle) {
+        PyObject* list = PyList_New(static_cast<Py_ssize_t>(src.size()));
+        if (!list) return handle();
+        for (size_t i = 0; i < src.size(); i++) {
+            PyObject* item = PyFloat_FromDouble(src[i]);
+            if (!item) {
+                Py_DECREF(list);
+                return handle();
+            }
+            PyList_SET_ITEM(list, static_cast<Py_ssize_t>(i), item);
+        }
+        return list;
+    }
+};
+
+}  // namespace detail
+}  // namespace pybind11
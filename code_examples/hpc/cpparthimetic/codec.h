@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+#include "vector.h"
+
+// Block-compressed float64 vectors. Every block of `block_size` elements is encoded on its own
+// (in parallel) and located through an offset table, so any range can be decoded without
+// touching the rest. Block methods:
+//   shuffle  - byte-shuffle, then LZ
+//   xor      - XOR with the previous value (Gorilla style), byte-shuffle, then LZ
+//   decimal  - values that are exact decimals with at most 15 fractional digits become scaled
+//              integers (as in ALP), are delta and zigzag coded, byte-shuffled, then LZ
+//   raw      - stored as is, used whenever a method would not save space
+// The "auto" codec tries decimal and falls back to xor per block.
+//
+// Layout: "CPV1", codec u8, 3 pad bytes, element count u64, block size u32, block count u32,
+// (block count + 1) u64 block offsets from the start of the block area, then the blocks. Each
+// block starts with its method byte and a parameter byte.
+
+namespace codec {
+
+enum Method : uint8_t { raw = 0, shuffle = 1, xor_delta = 2, decimal = 3, automatic = 255 };
+
+// LZ77 in the LZ4 block layout: token (literal length, match length - 4), literals, 16-bit
+// offset, with 15 meaning "more length bytes follow".
+inline size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+// A match costs at least three input bytes plus one per 255 of length, and a literal one byte
+// each, so no block decodes to more than this many bytes per byte of input.
+const uint64_t lz_max_expansion = 255;
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint8_t* put_length(uint8_t* op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = uint8_t(len);
+    return op;
+}
+
+inline size_t lz_compress(const uint8_t* src, size_t n, uint8_t* dst) {
+    const int hash_bits = 14;
+    std::vector<uint32_t> table(size_t(1) << hash_bits, 0);
+    uint8_t* op = dst;
+    size_t anchor = 0, i = 0;
+    size_t limit = n > 12 ? n - 12 : 0;
+    auto emit = [&](size_t literals_end, size_t match_len, size_t offset) {
+        size_t lit = literals_end - anchor;
+        uint8_t* token = op++;
+        *token = uint8_t(std::min<size_t>(lit, 15) << 4);
+        if (lit >= 15) op = put_length(op, lit - 15);
+        std::memcpy(op, src + anchor, lit);
+        op += lit;
+        if (match_len) {
+            op[0] = uint8_t(offset);
+            op[1] = uint8_t(offset >> 8);
+            op += 2;
+            size_t ml = match_len - 4;
+            *token |= uint8_t(std::min<size_t>(ml, 15));
+            if (ml >= 15) op = put_length(op, ml - 15);
+        }
+    };
+    size_t misses = 0;
+    while (i < limit) {
+        uint32_t seq = read32(src + i);
+        uint32_t h = (seq * 2654435761u) >> (32 - hash_bits);
+        size_t cand = table[h];
+        table[h] = uint32_t(i + 1);
+        if (cand && i + 1 - cand <= 65535 && read32(src + cand - 1) == seq) {
+            cand--;
+            size_t len = 4;
+            while (i + len < n - 5 && src[cand + len] == src[i + len]) len++;
+            emit(i, len, i - cand);
+            i += len;
+            anchor = i;
+            misses = 0;
+        } else {
+            i += 1 + (misses++ >> 6);
+        }
+    }
+    emit(n, 0, 0);
+    return size_t(op - dst);
+}
+
+// Returns false on malformed input instead of reading or writing out of bounds.
+inline bool lz_decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + n;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + capacity;
+    auto get_length = [&](size_t& len) {
+        uint8_t b;
+        do {
+            if (ip >= end) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(lit)) return false;
+        if (lit > size_t(end - ip) || lit > size_t(oend - op)) return false;
+        std::memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end) break;
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | size_t(ip[1]) << 8;
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !get_length(len)) return false;
+        len += 4;
+        if (offset == 0 || offset > size_t(op - dst) || len > size_t(oend - op)) return false;
+        const uint8_t* match = op - offset;
+        for (size_t k = 0; k < len; k++) op[k] = match[k];
+        op += len;
+    }
+    return op == oend;
+}
+
+// Byte plane b of element i goes to out[b * n + i].
+inline void byte_shuffle(const uint8_t* in, uint8_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < 8; b++) out[b * n + i] = in[i * 8 + b];
+    }
+}
+
+inline void byte_unshuffle(const uint8_t* in, uint8_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < 8; b++) out[i * 8 + b] = in[b * n + i];
+    }
+}
+
+inline const double* powers_of_ten() {
+    static const double p[16] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    return p;
+}
+
+// Smallest exponent e for which every value is an exact decimal with e fractional digits, or -1.
+inline int decimal_exponent(const double* x, size_t n) {
+    const double* p10 = powers_of_ten();
+    for (int e = 0; e < 16; e++) {
+        bool exact = true;
+        for (size_t i = 0; i < n && exact; i++) {
+            double scaled = x[i] * p10[e];
+            if (!(std::fabs(scaled) < 4503599627370496.0)) {
+                exact = false;
+                break;
+            }
+            double back = double(std::llround(scaled)) / p10[e];
+            exact = std::memcmp(&back, &x[i], sizeof(double)) == 0;
+        }
+        if (exact) return e;
+    }
+    return -1;
+}
+
+// Transforms one block into 64-bit words ready for shuffling; returns the method actually used.
+inline Method encode_words(const double* x, size_t n, Method method, uint64_t* words, uint8_t& param) {
+    if (method == automatic || method == decimal) {
+        int e = decimal_exponent(x, n);
+        if (e >= 0) {
+            int64_t prev = 0;
+            for (size_t i = 0; i < n; i++) {
+                int64_t q = std::llround(x[i] * powers_of_ten()[e]);
+                int64_t d = int64_t(uint64_t(q) - uint64_t(prev));
+                words[i] = (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+                prev = q;
+            }
+            param = uint8_t(e);
+            return decimal;
+        }
+        method = xor_delta;
+    }
+    std::memcpy(words, x, n * sizeof(double));
+    if (method == xor_delta) {
+        for (size_t i = n; i-- > 1;) words[i] ^= words[i - 1];
+    }
+    return method;
+}
+
+inline void decode_words(uint64_t* words, size_t n, Method method, uint8_t param, double* out) {
+    if (method == decimal) {
+        if (param > 15) throw std::invalid_argument("corrupt compressed block");
+        int64_t prev = 0;
+        for (size_t i = 0; i < n; i++) {
+            int64_t d = int64_t(words[i] >> 1) ^ -int64_t(words[i] & 1);
+            prev = int64_t(uint64_t(prev) + uint64_t(d));
+            out[i] = double(prev) / powers_of_ten()[param];
+        }
+        return;
+    }
+    if (method == xor_delta) {
+        for (size_t i = 1; i < n; i++) words[i] ^= words[i - 1];
+    }
+    std::memcpy(out, words, n * sizeof(double));
+}
+
+inline std::vector<uint8_t> encode_block(const double* x, size_t n, Method method) {
+    std::vector<uint8_t> out(2 + std::max(n * sizeof(double), lz_bound(n * sizeof(double))));
+    if (method != raw) {
+        std::vector<uint64_t> words(n);
+        std::vector<uint8_t> shuffled(n * sizeof(double));
+        uint8_t param = 0;
+        Method used = encode_words(x, n, method, words.data(), param);
+        byte_shuffle(reinterpret_cast<const uint8_t*>(words.data()), shuffled.data(), n);
+        size_t size = lz_compress(shuffled.data(), shuffled.size(), out.data() + 2);
+        if (size < n * sizeof(double)) {
+            out[0] = used;
+            out[1] = param;
+            out.resize(2 + size);
+            return out;
+        }
+    }
+    out[0] = raw;
+    out[1] = 0;
+    std::memcpy(out.data() + 2, x, n * sizeof(double));
+    out.resize(2 + n * sizeof(double));
+    return out;
+}
+
+inline void decode_block(const uint8_t* in, size_t size, double* out, size_t n) {
+    if (size < 2) throw std::invalid_argument("corrupt compressed block");
+    Method method = Method(in[0]);
+    if (method == raw) {
+        if (size - 2 != n * sizeof(double)) throw std::invalid_argument("corrupt compressed block");
+        std::memcpy(out, in + 2, n * sizeof(double));
+        return;
+    }
+    if (method != shuffle && method != xor_delta && method != decimal) {
+        throw std::invalid_argument("unknown block method");
+    }
+    std::vector<uint8_t> shuffled(n * sizeof(double));
+    std::vector<uint64_t> words(n);
+    if (!lz_decompress(in + 2, size - 2, shuffled.data(), shuffled.size())) {
+        throw std::invalid_argument("corrupt compressed block");
+    }
+    byte_unshuffle(shuffled.data(), reinterpret_cast<uint8_t*>(words.data()), n);
+    decode_words(words.data(), n, method, in[1], out);
+}
+
+inline Method parse_method(const std::string& name) {
+    if (name == "auto") return automatic;
+    if (name == "shuffle") return shuffle;
+    if (name == "xor") return xor_delta;
+    if (name == "decimal") return decimal;
+    if (name == "none") return raw;
+    throw std::invalid_argument("unknown codec '" + name + "'");
+}
+
+const size_t header_size = 24;
+
+// Parsed view of a compressed container.
+struct Container {
+    const uint8_t* data;
+    size_t size;
+    uint64_t count;
+    uint32_t block_size, blocks;
+
+    Container(const uint8_t* d, size_t n) : data(d), size(n) {
+        if (n < header_size || std::memcmp(d, "CPV1", 4) != 0) throw std::invalid_argument("not a compressed vector");
+        std::memcpy(&count, d + 8, 8);
+        std::memcpy(&block_size, d + 16, 4);
+        std::memcpy(&blocks, d + 20, 4);
+        // The block count is ceil(count / block_size), computed without wrapping near 2^64, and
+        // the blocks must be able to hold count elements at the codecs' best ratio: decompress()
+        // sizes its output from count before any block is decoded.
+        if (block_size == 0 || blocks != count / block_size + (count % block_size != 0)
+            || count > uint64_t(blocks) * block_size || n < header_size + (size_t(blocks) + 1) * 8
+            || offset(blocks) > n - body() || count > uint64_t(n - body()) * lz_max_expansion / sizeof(double)) {
+            throw std::invalid_argument("corrupt compressed vector header");
+        }
+    }
+
+    size_t body() const { return header_size + (size_t(blocks) + 1) * 8; }
+    uint64_t offset(size_t b) const {
+        uint64_t v;
+        std::memcpy(&v, data + header_size + b * 8, 8);
+        return v;
+    }
+
+    void decode(size_t b, double* out) const {
+        uint64_t begin = offset(b), end = offset(b + 1);
+        if (begin > end || end > size - body()) throw std::invalid_argument("corrupt compressed block offsets");
+        size_t n = std::min<uint64_t>(block_size, count - uint64_t(b) * block_size);
+        decode_block(data + body() + begin, size_t(end - begin), out, n);
+    }
+};
+
+}  // namespace codec
+
+inline std::string compress(const Vector& v, const std::string& codec_name, size_t block_size) {
+    codec::Method method = codec::parse_method(codec_name);
+    if (block_size == 0 || block_size > 0xffffffffu) throw std::invalid_argument("invalid block size");
+    size_t blocks = (v.size() + block_size - 1) / block_size;
+    std::vector<std::vector<uint8_t>> encoded(blocks);
+    parallel_invoke(blocks, [&](size_t b) {
+        size_t begin = b * block_size, n = std::min(block_size, v.size() - begin);
+        encoded[b] = codec::encode_block(v.data() + begin, n, method);
+    });
+
+    std::string out(codec::header_size + (blocks + 1) * 8, '\0');
+    std::memcpy(&out[0], "CPV1", 4);
+    out[4] = char(method);
+    uint64_t count = v.size();
+    uint32_t bs = uint32_t(block_size), nb = uint32_t(blocks);
+    std::memcpy(&out[8], &count, 8);
+    std::memcpy(&out[16], &bs, 4);
+    std::memcpy(&out[20], &nb, 4);
+    uint64_t offset = 0;
+    for (size_t b = 0; b <= blocks; b++) {
+        std::memcpy(&out[codec::header_size + b * 8], &offset, 8);
+        if (b < blocks) offset += encoded[b].size();
+    }
+    out.reserve(out.size() + offset);
+    for (auto& e : encoded) out.append(reinterpret_cast<const char*>(e.data()), e.size());
+    return out;
+}
+
+// Decode elements [start, stop) of a compressed container, touching only the blocks involved.
+inline Vector decompress(const uint8_t* data, size_t size, size_t start, size_t stop) {
+    codec::Container c(data, size);
+    stop = std::min<uint64_t>(stop, c.count);
+    start = std::min(start, stop);
+    Vector out(stop - start);
+    if (start == stop) return out;
+    size_t first = start / c.block_size, last = (stop - 1) / c.block_size;
+    parallel_invoke(last - first + 1, [&](size_t k) {
+        size_t b = first + k, begin = b * c.block_size;
+        size_t n = std::min<uint64_t>(c.block_size, c.count - begin);
+        if (begin >= start && begin + n <= stop) {
+            c.decode(b, out.data() + (begin - start));
+            return;
+        }
+        std::vector<double> tmp(n);
+        c.decode(b, tmp.data());
+        size_t lo = std::max(begin, start), hi = std::min(begin + n, stop);
+        std::copy(tmp.begin() + (lo - begin), tmp.begin() + (hi - begin), out.data() + (lo - start));
+    });
+    return out;
+}
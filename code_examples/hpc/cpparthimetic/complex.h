@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include "kernels.h"
+#include "simd.h"
+
+// Complex kernels in two layouts: interleaved (re, im pairs, as in complex128 arrays) and split
+// (separate re and im arrays). Written as plain loops over both parts of each element so GCC's
+// SLP pass emits the permute + vfmaddsub pattern for interleaved data and straight FMAs for split
+// data. They use FMA, so the last bit may differ between instruction sets.
+
+SIMD_CLONES_FMA inline void cmul_interleaved(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double xr = a[2 * i], xi = a[2 * i + 1], yr = b[2 * i], yi = b[2 * i + 1];
+        c[2 * i] = xr * yr - xi * yi;
+        c[2 * i + 1] = xr * yi + xi * yr;
+    }
+}
+
+// a * conj(b)
+SIMD_CLONES_FMA inline void cmulconj_interleaved(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double xr = a[2 * i], xi = a[2 * i + 1], yr = b[2 * i], yi = b[2 * i + 1];
+        c[2 * i] = xr * yr + xi * yi;
+        c[2 * i + 1] = xi * yr - xr * yi;
+    }
+}
+
+// Smith's scaled division: dividing through by the larger part of b keeps the intermediate
+// products in range, where the textbook (xr*yr + xi*yi) / (yr^2 + yi^2) overflows or underflows
+// for |b| beyond about 1e154 or below 1e-154.
+SIMD_CLONES_FMA inline void cdiv_interleaved(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double xr = a[2 * i], xi = a[2 * i + 1], yr = b[2 * i], yi = b[2 * i + 1];
+        bool wide = std::fabs(yr) >= std::fabs(yi);
+        double r = wide ? yi / yr : yr / yi;
+        double d = wide ? yr + yi * r : yi + yr * r;
+        double pr = wide ? xr + xi * r : xr * r + xi;
+        double pi = wide ? xi - xr * r : xi * r - xr;
+        c[2 * i] = pr / d;
+        c[2 * i + 1] = pi / d;
+    }
+}
+
+// |a| scaled by its larger part, like hypot, so it neither overflows nor loses tiny values. Also
+// like hypot, an infinite part gives +inf whatever the other part is: inf / inf would make q NaN.
+SIMD_CLONES_FMA inline void cabs_interleaved(const double* a, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double x = std::fabs(a[2 * i]), y = std::fabs(a[2 * i + 1]);
+        double big = x > y ? x : y, small = x > y ? y : x;
+        double q = small / (big > 0 ? big : 1.0);
+        c[i] = x == HUGE_VAL || y == HUGE_VAL ? HUGE_VAL : big * std::sqrt(1.0 + q * q);
+    }
+}
+
+SIMD_CLONES_FMA inline void cmul_split(const double* ar, const double* ai, const double* br, const double* bi,
+                                       double* cr, double* ci, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double xr = ar[i], xi = ai[i], yr = br[i], yi = bi[i];
+        cr[i] = xr * yr - xi * yi;
+        ci[i] = xr * yi + xi * yr;
+    }
+}
+
+SIMD_CLONES_FMA inline void cmulconj_split(const double* ar, const double* ai, const double* br, const double* bi,
+                                           double* cr, double* ci, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double xr = ar[i], xi = ai[i], yr = br[i], yi = bi[i];
+        cr[i] = xr * yr + xi * yi;
+        ci[i] = xi * yr - xr * yi;
+    }
+}
+
+SIMD_CLONES_FMA inline void cdiv_split(const double* ar, const double* ai, const double* br, const double* bi,
+                                       double* cr, double* ci, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double xr = ar[i], xi = ai[i], yr = br[i], yi = bi[i];
+        bool wide = std::fabs(yr) >= std::fabs(yi);
+        double r = wide ? yi / yr : yr / yi;
+        double d = wide ? yr + yi * r : yi + yr * r;
+        double pr = wide ? xr + xi * r : xr * r + xi;
+        double pi = wide ? xi - xr * r : xi * r - xr;
+        cr[i] = pr / d;
+        ci[i] = pi / d;
+    }
+}
+
+SIMD_CLONES_FMA inline void cabs_split(const double* ar, const double* ai, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double x = std::fabs(ar[i]), y = std::fabs(ai[i]);
+        double big = x > y ? x : y, small = x > y ? y : x;
+        double q = small / (big > 0 ? big : 1.0);
+        c[i] = x == HUGE_VAL || y == HUGE_VAL ? HUGE_VAL : big * std::sqrt(1.0 + q * q);
+    }
+}
+
+inline void cadd_interleaved(const double* a, const double* b, double* c, size_t n) {
+    add_kernel(a, b, c, 2 * n);
+}
+
+inline void cadd_split(const double* ar, const double* ai, const double* br, const double* bi, double* cr, double* ci,
+                       size_t n) {
+    add_kernel(ar, br, cr, n);
+    add_kernel(ai, bi, ci, n);
+}
+
+// A complex vector in either layout: interleaved data has im == re + 1 and stride 2.
+struct ComplexRef {
+    const double* re;
+    const double* im;
+    size_t stride;
+};
+
+typedef void (*complex_interleaved_kernel)(const double*, const double*, double*, size_t);
+typedef void (*complex_split_kernel)(const double*, const double*, const double*, const double*, double*, double*, size_t);
+
+struct ComplexOp {
+    complex_interleaved_kernel interleaved;
+    complex_split_kernel split;
+};
+
+const ComplexOp cadd_op = {cadd_interleaved, cadd_split};
+const ComplexOp cmul_op = {cmul_interleaved, cmul_split};
+const ComplexOp cmulconj_op = {cmulconj_interleaved, cmulconj_split};
+const ComplexOp cdiv_op = {cdiv_interleaved, cdiv_split};
+
+// (cr, ci) = a op b over n complex elements; a, b and the output share one layout (ci is unused
+// for interleaved data).
+inline void complex_elementwise(ComplexRef a, ComplexRef b, double* cr, double* ci, size_t n, const ComplexOp& op,
+                                const ElementwiseParams& p) {
+    auto run = [&](size_t begin, size_t end) {
+        size_t o = begin * a.stride;
+        if (a.stride == 2) {
+            op.interleaved(a.re + o, b.re + o, cr + o, end - begin);
+        } else {
+            op.split(a.re + o, a.im + o, b.re + o, b.im + o, cr + o, ci + o, end - begin);
+        }
+    };
+    if (n < p.threshold) {
+        run(0, n);
+        return;
+    }
+    parallel_for(n, p.grain, [&](size_t, size_t begin, size_t end) { run(begin, end); }, p.threads);
+}
+
+inline void complex_abs(ComplexRef a, double* c, size_t n, const ElementwiseParams& p) {
+    auto run = [&](size_t begin, size_t end) {
+        size_t o = begin * a.stride;
+        if (a.stride == 2) {
+            cabs_interleaved(a.re + o, c + begin, end - begin);
+        } else {
+            cabs_split(a.re + o, a.im + o, c + begin, end - begin);
+        }
+    };
+    if (n < p.threshold) {
+        run(0, n);
+        return;
+    }
+    parallel_for(n, p.grain, [&](size_t, size_t begin, size_t end) { run(begin, end); }, p.threads);
+}
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "kernels.h"
+#include "simd.h"
+
+// Elementwise expressions such as "(a + b) / (c * c + 1)" compiled once into register bytecode and
+// run block by block: every instruction streams one block of each operand through a SIMD loop,
+// so intermediates live in a few L1-sized scratch blocks instead of full-length temporaries.
+//
+// Grammar: + - * / and ** (or ^), unary minus, parentheses, numbers, variable names, and the
+// functions abs sqrt exp log sin cos tanh (one argument), min max pow (two arguments).
+
+namespace expr {
+
+enum class OpCode : uint8_t { add, sub, mul, div, pow, min, max, neg, abs, sqrt, exp, log, sin, cos, tanh };
+
+// Elements per block; a dozen live registers still fit in L1.
+const size_t block = 512;
+
+SIMD_CLONES inline void sub_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = a[i] - b[i];
+}
+SIMD_CLONES inline void min_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = b[i] < a[i] ? b[i] : a[i];
+}
+SIMD_CLONES inline void max_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = b[i] > a[i] ? b[i] : a[i];
+}
+SIMD_CLONES inline void neg_kernel(const double* a, const double*, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = -a[i];
+}
+SIMD_CLONES inline void abs_kernel(const double* a, const double*, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = std::fabs(a[i]);
+}
+SIMD_CLONES inline void sqrt_kernel(const double* a, const double*, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = std::sqrt(a[i]);
+}
+
+// No vector libm here; these run scalar but still avoid temporaries.
+inline void pow_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = std::pow(a[i], b[i]);
+}
+template <double (*F)(double)>
+void libm_kernel(const double* a, const double*, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = F(a[i]);
+}
+
+inline double exp_(double x) { return std::exp(x); }
+inline double log_(double x) { return std::log(x); }
+inline double sin_(double x) { return std::sin(x); }
+inline double cos_(double x) { return std::cos(x); }
+inline double tanh_(double x) { return std::tanh(x); }
+
+inline binary_kernel kernel_for(OpCode op) {
+    static const binary_kernel kernels[] = {
+        add_kernel, sub_kernel, mul_kernel, div_kernel, pow_kernel, min_kernel, max_kernel, neg_kernel, abs_kernel,
+        sqrt_kernel, libm_kernel<exp_>, libm_kernel<log_>, libm_kernel<sin_>, libm_kernel<cos_>, libm_kernel<tanh_>,
+    };
+    return kernels[size_t(op)];
+}
+
+inline double fold(OpCode op, double a, double b) {
+    double c;
+    kernel_for(op)(&a, &b, &c, 1);
+    return c;
+}
+
+inline bool is_unary(OpCode op) { return op >= OpCode::neg; }
+
+inline const char* op_name(OpCode op) {
+    static const char* names[] = {"add", "sub", "mul", "div", "pow", "min", "max", "neg",
+                                  "abs", "sqrt", "exp", "log", "sin", "cos", "tanh"};
+    return names[size_t(op)];
+}
+
+// dst = a op b over one block. Registers [0, variables) are the inputs, then the constants,
+// then scratch.
+struct Instr {
+    OpCode op;
+    uint16_t dst, a, b;
+};
+
+struct Program {
+    std::string text;
+    std::vector<std::string> variables;
+    std::vector<double> constants;
+    std::vector<Instr> code;
+    size_t registers = 0;
+    uint16_t result = 0;
+
+    size_t first_scratch() const { return variables.size() + constants.size(); }
+
+    // Readable listing, one instruction per line.
+    std::string disassemble() const {
+        auto reg = [&](uint16_t r) {
+            if (r < variables.size()) return variables[r];
+            if (r < first_scratch()) return std::to_string(constants[r - variables.size()]);
+            return "r" + std::to_string(r - first_scratch());
+        };
+        std::string out;
+        for (const Instr& in : code) {
+            out += reg(in.dst) + " = " + op_name(in.op) + " " + reg(in.a);
+            if (!is_unary(in.op)) out += ", " + reg(in.b);
+            out += "\n";
+        }
+        out += "return " + reg(result) + "\n";
+        return out;
+    }
+
+    // out[i] = expression over inputs[k][i] for i in [begin, end). Each input is an array of n
+    // elements, or a scalar broadcast when its stride is 0.
+    void run(const double* const* inputs, const size_t* strides, double* out, size_t begin, size_t end) const {
+        std::vector<double> scratch((registers - variables.size()) * block);
+        std::vector<const double*> src(registers);
+        std::vector<double*> dst(registers, nullptr);
+        size_t nvars = variables.size();
+        for (size_t k = 0; k < registers - nvars; k++) dst[nvars + k] = scratch.data() + k * block;
+        for (size_t k = 0; k < constants.size(); k++) std::fill(dst[nvars + k], dst[nvars + k] + block, constants[k]);
+        // Scalar inputs are broadcast into blocks of their own.
+        std::vector<double> broadcast;
+        for (size_t k = 0; k < nvars; k++) {
+            if (strides[k] == 0) broadcast.resize(broadcast.size() + block, inputs[k][0]);
+        }
+        for (size_t k = 0, used = 0; k < nvars; k++) {
+            if (strides[k] == 0) src[k] = broadcast.data() + block * used++;
+        }
+        for (size_t k = nvars; k < registers; k++) src[k] = dst[k];
+
+        for (size_t i = begin; i < end; i += block) {
+            size_t m = std::min(block, end - i);
+            for (size_t k = 0; k < nvars; k++) {
+                if (strides[k]) src[k] = inputs[k] + i;
+            }
+            for (size_t pc = 0; pc < code.size(); pc++) {
+                const Instr& in = code[pc];
+                // The last instruction produces the result and writes it straight to out.
+                double* d = pc + 1 == code.size() ? out + i : dst[in.dst];
+                kernel_for(in.op)(src[in.a], src[in.b], d, m);
+            }
+            if (code.empty()) std::copy(src[result], src[result] + m, out + i);
+        }
+    }
+};
+
+// Recursive descent parser producing a tree, folded and then emitted as bytecode.
+struct Node {
+    enum Kind { number, variable, apply } kind;
+    double value = 0;
+    size_t var = 0;
+    size_t depth = 1;
+    OpCode op = OpCode::add;
+    std::unique_ptr<Node> a, b;
+};
+
+// Parsing, emitting and freeing all recurse, so user text is limited to this many nested
+// parentheses, unary signs and calls, and to trees this deep (a chain of n additions is n deep).
+const size_t max_nesting = 256;
+const size_t max_tree_depth = 4096;
+
+class Parser {
+public:
+    Parser(const std::string& text, Program& program) : s(text), prog(program) {}
+
+    std::unique_ptr<Node> parse() {
+        std::unique_ptr<Node> n = sum();
+        skip();
+        if (pos != s.size()) fail("unexpected '" + std::string(1, s[pos]) + "'");
+        return n;
+    }
+
+private:
+    const std::string& s;
+    Program& prog;
+    size_t pos = 0;
+    size_t nesting = 0;
+
+    struct Nested {
+        Parser& p;
+        explicit Nested(Parser& parser) : p(parser) {
+            if (++p.nesting > max_nesting) p.fail("expression too deeply nested");
+        }
+        ~Nested() { p.nesting--; }
+    };
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::invalid_argument("expression: " + what + " at position " + std::to_string(pos));
+    }
+    void skip() {
+        while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos]))) pos++;
+    }
+    bool eat(const char* token) {
+        skip();
+        size_t len = std::strlen(token);
+        if (s.compare(pos, len, token) != 0) return false;
+        pos += len;
+        return true;
+    }
+    std::unique_ptr<Node> make(OpCode op, std::unique_ptr<Node> a, std::unique_ptr<Node> b = nullptr) const {
+        // Fold operations on constants right away.
+        if (a->kind == Node::number && (!b || b->kind == Node::number)) {
+            a->value = fold(op, a->value, b ? b->value : 0.0);
+            return a;
+        }
+        std::unique_ptr<Node> n(new Node());
+        n->kind = Node::apply;
+        n->depth = 1 + std::max(a->depth, b ? b->depth : 0);
+        if (n->depth > max_tree_depth) fail("expression too deeply nested");
+        n->op = op;
+        n->a = std::move(a);
+        n->b = std::move(b);
+        return n;
+    }
+
+    std::unique_ptr<Node> sum() {
+        std::unique_ptr<Node> n = product();
+        while (true) {
+            if (eat("+")) n = make(OpCode::add, std::move(n), product());
+            else if (eat("-")) n = make(OpCode::sub, std::move(n), product());
+            else return n;
+        }
+    }
+    std::unique_ptr<Node> product() {
+        std::unique_ptr<Node> n = unary();
+        while (true) {
+            skip();
+            if (s.compare(pos, 2, "**") == 0) return n;
+            if (eat("*")) n = make(OpCode::mul, std::move(n), unary());
+            else if (eat("/")) n = make(OpCode::div, std::move(n), unary());
+            else return n;
+        }
+    }
+    // Every recursive path (parentheses, calls, signs, exponents) passes through here.
+    std::unique_ptr<Node> unary() {
+        Nested guard(*this);
+        if (eat("-")) return make(OpCode::neg, unary());
+        if (eat("+")) return unary();
+        return power();
+    }
+    std::unique_ptr<Node> power() {
+        std::unique_ptr<Node> n = atom();
+        if (eat("**") || eat("^")) return make(OpCode::pow, std::move(n), unary());
+        return n;
+    }
+    std::unique_ptr<Node> atom() {
+        skip();
+        if (pos == s.size()) fail("unexpected end");
+        if (eat("(")) {
+            std::unique_ptr<Node> n = sum();
+            if (!eat(")")) fail("expected ')'");
+            return n;
+        }
+        char c = s[pos];
+        if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+            const char* begin = s.c_str() + pos;
+            char* end;
+            double v = std::strtod(begin, &end);
+            if (end == begin) fail("bad number");
+            pos += size_t(end - begin);
+            std::unique_ptr<Node> n(new Node());
+            n->kind = Node::number;
+            n->value = v;
+            return n;
+        }
+        if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            size_t start = pos;
+            while (pos < s.size() && (std::isalnum(static_cast<unsigned char>(s[pos])) || s[pos] == '_')) pos++;
+            std::string name = s.substr(start, pos - start);
+            if (eat("(")) return call(name);
+            std::unique_ptr<Node> n(new Node());
+            n->kind = Node::variable;
+            auto it = std::find(prog.variables.begin(), prog.variables.end(), name);
+            n->var = size_t(it - prog.variables.begin());
+            if (it == prog.variables.end()) prog.variables.push_back(name);
+            return n;
+        }
+        fail("unexpected '" + std::string(1, c) + "'");
+    }
+    std::unique_ptr<Node> call(const std::string& name) {
+        static const std::unordered_map<std::string, OpCode> functions = {
+            {"abs", OpCode::abs}, {"sqrt", OpCode::sqrt}, {"exp", OpCode::exp}, {"log", OpCode::log},
+            {"sin", OpCode::sin}, {"cos", OpCode::cos},   {"tanh", OpCode::tanh}, {"min", OpCode::min},
+            {"max", OpCode::max}, {"pow", OpCode::pow},
+        };
+        auto it = functions.find(name);
+        if (it == functions.end()) fail("unknown function '" + name + "'");
+        std::unique_ptr<Node> a = sum(), b;
+        if (!is_unary(it->second)) {
+            if (!eat(",")) fail("expected ',' in " + name + "()");
+            b = sum();
+        }
+        if (!eat(")")) fail("expected ')' after arguments of " + name + "()");
+        return make(it->second, std::move(a), std::move(b));
+    }
+};
+
+// Emits code for a folded tree; scratch registers are recycled as soon as their value is used.
+class Emitter {
+public:
+    explicit Emitter(Program& program) : prog(program) {}
+
+    void emit(const Node& root) {
+        collect_constants(root);
+        next = prog.first_scratch();
+        prog.result = value(root);
+        prog.registers = std::max<size_t>(next, prog.first_scratch());
+        if (prog.registers > UINT16_MAX) throw std::invalid_argument("expression: too large");
+    }
+
+private:
+    Program& prog;
+    std::vector<uint16_t> free_regs;
+    size_t next = 0;
+
+    // Constants are matched by bit pattern, so a folded NaN finds its own register and -0.0 keeps
+    // its sign.
+    std::vector<double>::const_iterator find_constant(double v) const {
+        return std::find_if(prog.constants.begin(), prog.constants.end(), [v](double c) {
+            uint64_t x, y;
+            std::memcpy(&x, &c, sizeof(x));
+            std::memcpy(&y, &v, sizeof(y));
+            return x == y;
+        });
+    }
+    void collect_constants(const Node& n) {
+        if (n.kind == Node::number && find_constant(n.value) == prog.constants.end()) {
+            prog.constants.push_back(n.value);
+        }
+        if (n.a) collect_constants(*n.a);
+        if (n.b) collect_constants(*n.b);
+    }
+    bool scratch(uint16_t r) const { return r >= prog.first_scratch(); }
+    uint16_t value(const Node& n) {
+        if (n.kind == Node::variable) return uint16_t(n.var);
+        if (n.kind == Node::number) {
+            auto it = find_constant(n.value);
+            if (it == prog.constants.end()) throw std::logic_error("expression: constant was not collected");
+            return uint16_t(prog.variables.size() + size_t(it - prog.constants.begin()));
+        }
+        uint16_t a = value(*n.a);
+        uint16_t b = n.b ? value(*n.b) : a;
+        if (n.b && scratch(b)) free_regs.push_back(b);
+        if (scratch(a) && a != b) free_regs.push_back(a);
+        uint16_t dst;
+        if (!free_regs.empty()) {
+            dst = free_regs.back();
+            free_regs.pop_back();
+        } else {
+            dst = uint16_t(next++);
+        }
+        prog.code.push_back({n.op, dst, a, b});
+        return dst;
+    }
+};
+
+inline std::shared_ptr<const Program> compile_uncached(const std::string& text) {
+    std::shared_ptr<Program> prog = std::make_shared<Program>();
+    prog->text = text;
+    Parser parser(text, *prog);
+    std::unique_ptr<Node> root = parser.parse();
+    Emitter(*prog).emit(*root);
+    return prog;
+}
+
+// The most recently used compiled programs by expression text, so evaluating the same text again
+// is a hash lookup while a stream of distinct texts cannot grow the cache without bound.
+class ProgramCache {
+public:
+    static const size_t capacity = 256;
+
+    std::shared_ptr<const Program> find(const std::string& text) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(text);
+        if (it == entries.end()) return nullptr;
+        order.splice(order.begin(), order, it->second.second);
+        return it->second.first;
+    }
+
+    std::shared_ptr<const Program> insert(const std::string& text, std::shared_ptr<const Program> prog) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(text);
+        if (it != entries.end()) return it->second.first;
+        order.push_front(text);
+        entries.emplace(text, std::make_pair(prog, order.begin()));
+        if (entries.size() > capacity) {
+            entries.erase(order.back());
+            order.pop_back();
+        }
+        return prog;
+    }
+
+private:
+    std::mutex lock;
+    std::list<std::string> order;
+    std::unordered_map<std::string, std::pair<std::shared_ptr<const Program>, std::list<std::string>::iterator>> entries;
+};
+
+inline ProgramCache& program_cache() {
+    static ProgramCache cache;
+    return cache;
+}
+
+inline std::shared_ptr<const Program> compile(const std::string& text) {
+    ProgramCache& cache = program_cache();
+    if (std::shared_ptr<const Program> prog = cache.find(text)) return prog;
+    return cache.insert(text, compile_uncached(text));
+}
+
+// Evaluate over n elements in parallel chunks; inputs follow prog.variables.
+inline void evaluate(const Program& prog, const double* const* inputs, const size_t* strides, double* out, size_t n,
+                     const ElementwiseParams& p) {
+    if (n < p.threshold) {
+        prog.run(inputs, strides, out, 0, n);
+        return;
+    }
+    size_t grain = (std::max(p.grain, block) + block - 1) / block * block;
+    parallel_for(n, grain, [&](size_t, size_t begin, size_t end) { prog.run(inputs, strides, out, begin, end); },
+                 p.threads);
+}
+
+}  // namespace expr
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define GATHER_X86 1
+#endif
+
+#include "parallel.h"
+#include "simd.h"
+
+// Index-based gather (take), scatter (put) and scatter-add. Random indices make these latency
+// bound, so the scalar loops prefetch a fixed distance ahead; hardware gather instructions only
+// win when the source is cache resident, so they are used for small sources only.
+
+const size_t gather_grain = 1 << 14;
+const size_t prefetch_distance = 16;
+// Sources up to this many elements (2 MB) are gathered with vgatherqpd.
+const size_t gather_cached = 1 << 18;
+
+// Throws unless every index is in [0, n).
+inline void check_indices(const int64_t* idx, size_t count, size_t n) {
+    size_t threads = num_workers(), chunks = parallel_chunks(count, gather_grain, threads);
+    std::vector<char> bad(chunks, 0);
+    parallel_for(count, gather_grain, [&](size_t c, size_t begin, size_t end) {
+        uint64_t worst = 0;
+        // Negative indices wrap to huge unsigned values and fail the same test.
+        for (size_t i = begin; i < end; i++) worst = std::max(worst, uint64_t(idx[i]));
+        bad[c] = count && worst >= n;
+    }, threads);
+    for (char b : bad) {
+        if (b) throw std::out_of_range("index out of range");
+    }
+}
+
+inline void gather_prefetch(const double* src, const int64_t* idx, double* out, size_t n) {
+    size_t i = 0;
+    for (; i + prefetch_distance < n; i++) {
+        __builtin_prefetch(src + idx[i + prefetch_distance]);
+        out[i] = src[idx[i]];
+    }
+    for (; i < n; i++) out[i] = src[idx[i]];
+}
+
+#ifdef GATHER_X86
+__attribute__((target("avx2"))) inline void gather_avx2(const double* src, const int64_t* idx, double* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i j = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + i));
+        _mm256_storeu_pd(out + i, _mm256_i64gather_pd(src, j, 8));
+    }
+    for (; i < n; i++) out[i] = src[idx[i]];
+}
+
+__attribute__((target("avx512f"))) inline void gather_avx512(const double* src, const int64_t* idx, double* out,
+                                                             size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i j = _mm512_loadu_si512(idx + i);
+        _mm512_storeu_pd(out + i, _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xff, j, src, 8));
+    }
+    for (; i < n; i++) out[i] = src[idx[i]];
+}
+#endif
+
+typedef void (*gather_kernel)(const double*, const int64_t*, double*, size_t);
+
+inline gather_kernel select_gather(size_t source_size) {
+#ifdef GATHER_X86
+    if (source_size <= gather_cached) {
+        if (cpu_features().avx512f) return gather_avx512;
+        if (cpu_features().avx2) return gather_avx2;
+    }
+#endif
+    (void)source_size;
+    return gather_prefetch;
+}
+
+// out[i] = src[idx[i]]; indices must already be checked.
+inline void take(const double* src, size_t n, const int64_t* idx, double* out, size_t count) {
+    gather_kernel kernel = select_gather(n);
+    parallel_for(count, gather_grain, [&](size_t, size_t begin, size_t end) {
+        kernel(src, idx + begin, out + begin, end - begin);
+    });
+}
+
+// Scatter with conflicts resolved by ownership: (index, position) pairs are bucketed by
+// destination range, keeping their order, and each thread applies one bucket. Duplicate indices
+// therefore land in input order (put: last one wins) whatever the thread count.
+template <typename Apply>
+void bucketed_scatter(size_t n, const int64_t* idx, size_t count, Apply apply) {
+    size_t threads = num_workers(), chunks = parallel_chunks(count, gather_grain, threads);
+    size_t buckets = std::max<size_t>(1, std::min(threads, n));
+    size_t span = (n + buckets - 1) / buckets;
+    if (buckets == 1 || chunks == 1) {
+        for (size_t i = 0; i < count; i++) apply(size_t(idx[i]), i);
+        return;
+    }
+    // counts[c * buckets + b]: entries of chunk c bound for bucket b, then their write positions.
+    std::vector<size_t> counts(chunks * buckets, 0);
+    parallel_for(count, gather_grain, [&](size_t c, size_t begin, size_t end) {
+        size_t* row = counts.data() + c * buckets;
+        for (size_t i = begin; i < end; i++) row[size_t(idx[i]) / span]++;
+    }, threads);
+    std::vector<size_t> bucket_start(buckets + 1, 0);
+    size_t total = 0;
+    for (size_t b = 0; b < buckets; b++) {
+        bucket_start[b] = total;
+        for (size_t c = 0; c < chunks; c++) {
+            size_t k = counts[c * buckets + b];
+            counts[c * buckets + b] = total;
+            total += k;
+        }
+    }
+    bucket_start[buckets] = total;
+    std::vector<uint64_t> order(count);
+    parallel_for(count, gather_grain, [&](size_t c, size_t begin, size_t end) {
+        size_t* row = counts.data() + c * buckets;
+        for (size_t i = begin; i < end; i++) order[row[size_t(idx[i]) / span]++] = i;
+    }, threads);
+    parallel_invoke(buckets, [&](size_t b) {
+        for (size_t k = bucket_start[b]; k < bucket_start[b + 1]; k++) {
+            size_t i = order[k];
+            apply(size_t(idx[i]), i);
+        }
+    }, threads);
+}
+
+// dst[idx[i]] = values[i]
+inline void put(double* dst, size_t n, const int64_t* idx, const double* values, size_t count) {
+    bucketed_scatter(n, idx, count, [&](size_t j, size_t i) { dst[j] = values[i]; });
+}
+
+// dst[idx[i]] += values[i], duplicates accumulating. When a private copy of dst per thread is
+// cheap next to the index count, threads add into zeroed copies that are then summed in thread
+// order; otherwise the bucketed scatter gives each thread exclusive destinations.
+inline void scatter_add(double* dst, size_t n, const int64_t* idx, const double* values, size_t count) {
+    size_t threads = num_workers(), chunks = parallel_chunks(count, gather_grain, threads);
+    if (chunks > 1 && n * chunks <= 2 * count) {
+        std::vector<double> priv(chunks * n, 0.0);
+        parallel_for(count, gather_grain, [&](size_t c, size_t begin, size_t end) {
+            double* mine = priv.data() + c * n;
+            size_t i = begin;
+            for (; i + prefetch_distance < end; i++) {
+                __builtin_prefetch(mine + idx[i + prefetch_distance], 1);
+                mine[idx[i]] += values[i];
+            }
+            for (; i < end; i++) mine[idx[i]] += values[i];
+        }, threads);
+        parallel_for(n, gather_grain, [&](size_t, size_t begin, size_t end) {
+            for (size_t c = 0; c < chunks; c++) {
+                const double* mine = priv.data() + c * n;
+                for (size_t j = begin; j < end; j++) dst[j] += mine[j];
+            }
+        }, threads);
+        return;
+    }
+    bucketed_scatter(n, idx, count, [&](size_t j, size_t i) { dst[j] += values[i]; });
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "parallel.h"
+#include "simd.h"
+
+// Row-major matrix view; element (i, j) of op(M) honours the transpose flag.
+template <typename T>
+struct MatrixRef {
+    const T* data;
+    size_t ld;
+    bool trans;
+    T operator()(size_t i, size_t j) const { return trans ? data[j * ld + i] : data[i * ld + j]; }
+};
+
+// Blocking parameters: an MR x NR register tile of C is kept in accumulators, A is packed in
+// MC x KC blocks (L2) and B in KC x NC panels (L3), both laid out in micro-panel order.
+template <typename T>
+struct GemmBlocking {
+    static constexpr size_t MR = 6;
+    static constexpr size_t NR = 64 / sizeof(T);
+    static constexpr size_t KC = 256;
+    static constexpr size_t MC = 96;
+    static constexpr size_t NC = 2048;
+};
+
+// The MR x NR tile lives in MR 64-byte GCC vector registers (one zmm, two ymm or four xmm
+// per row depending on the clone); each step broadcasts one element of A per row.
+template <typename T>
+SIMD_CLONES_FMA void gemm_micro_kernel(size_t kc, const T* ap, const T* bp, T* acc) {
+    typedef T vec __attribute__((vector_size(64)));
+    const size_t MR = GemmBlocking<T>::MR;
+    vec c[MR] = {};
+    for (size_t p = 0; p < kc; p++) {
+        vec b;
+        std::memcpy(&b, bp + p * GemmBlocking<T>::NR, sizeof(b));
+        for (size_t r = 0; r < MR; r++) c[r] += ap[p * MR + r] * b;
+    }
+    std::memcpy(acc, c, sizeof(c));
+}
+
+// Pack rows [i0, i0+mc) x cols [p0, p0+kc) of op(A) into MR-row micro-panels, zero padded.
+template <typename T>
+void pack_a(const MatrixRef<T>& a, size_t i0, size_t mc, size_t p0, size_t kc, T* out) {
+    const size_t MR = GemmBlocking<T>::MR;
+    for (size_t ir = 0; ir < mc; ir += MR) {
+        size_t rows = std::min(MR, mc - ir);
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t r = 0; r < MR; r++) *out++ = r < rows ? a(i0 + ir + r, p0 + p) : T(0);
+        }
+    }
+}
+
+// Pack rows [p0, p0+kc) x cols [j0, j0+nc) of op(B) into NR-column micro-panels, zero padded.
+template <typename T>
+void pack_b(const MatrixRef<T>& b, size_t p0, size_t kc, size_t j0, size_t nc, T* out) {
+    const size_t NR = GemmBlocking<T>::NR;
+    for (size_t jr = 0; jr < nc; jr += NR) {
+        size_t cols = std::min(NR, nc - jr);
+        T* panel = out + jr * kc;
+        for (size_t p = 0; p < kc; p++) {
+            for (size_t j = 0; j < NR; j++) panel[p * NR + j] = j < cols ? b(p0 + p, j0 + jr + j) : T(0);
+        }
+    }
+}
+
+// C = alpha * op(A) op(B) + beta * C, with op(A) m x k, op(B) k x n and all matrices row-major.
+// Row blocks of C are distributed over the workers; each packs its own A block and shares the
+// packed B panel.
+template <typename T>
+void gemm(size_t m, size_t n, size_t k, T alpha, MatrixRef<T> a, MatrixRef<T> b, T beta, T* c, size_t ldc) {
+    using B = GemmBlocking<T>;
+    parallel_for(m, 16, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            T* row = c + i * ldc;
+            for (size_t j = 0; j < n; j++) row[j] = beta == T(0) ? T(0) : beta * row[j];
+        }
+    });
+    if (k == 0 || alpha == T(0)) return;
+
+    std::vector<T> bpack(B::KC * (B::NC + B::NR));
+    size_t mblocks = (m + B::MC - 1) / B::MC;
+    for (size_t jc = 0; jc < n; jc += B::NC) {
+        size_t nc = std::min(B::NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += B::KC) {
+            size_t kc = std::min(B::KC, k - pc);
+            size_t panels = (nc + B::NR - 1) / B::NR;
+            parallel_invoke(panels, [&](size_t jp) {
+                size_t jr = jp * B::NR;
+                pack_b(b, pc, kc, jc + jr, std::min(B::NR, nc - jr), bpack.data() + jr * kc);
+            });
+
+            parallel_invoke(mblocks, [&](size_t blk) {
+                size_t ic = blk * B::MC, mc = std::min(B::MC, m - ic);
+                std::vector<T> apack(B::MC * kc);
+                T acc[B::MR * B::NR];
+                pack_a(a, ic, mc, pc, kc, apack.data());
+                for (size_t jr = 0; jr < nc; jr += B::NR) {
+                    for (size_t ir = 0; ir < mc; ir += B::MR) {
+                        gemm_micro_kernel<T>(kc, apack.data() + ir * kc, bpack.data() + jr * kc, acc);
+                        size_t rows = std::min(B::MR, mc - ir), cols = std::min(B::NR, nc - jr);
+                        for (size_t r = 0; r < rows; r++) {
+                            T* out = c + (ic + ir + r) * ldc + jc + jr;
+                            for (size_t j = 0; j < cols; j++) out[j] += alpha * acc[r * B::NR + j];
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+template <typename T>
+SIMD_CLONES_FMA T dot(const T* x, const T* y, size_t n) {
+    const size_t lanes = 16;
+    T acc[lanes] = {};
+    size_t body = n - n % lanes;
+    for (size_t i = 0; i < body; i += lanes) {
+        for (size_t j = 0; j < lanes; j++) acc[j] += x[i + j] * y[i + j];
+    }
+    for (size_t i = body; i < n; i++) acc[0] += x[i] * y[i];
+    T s = 0;
+    for (size_t j = 0; j < lanes; j++) s += acc[j];
+    return s;
+}
+
+template <typename T>
+SIMD_CLONES_FMA void axpy(T alpha, const T* x, T* y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] += alpha * x[i];
+}
+
+// y = alpha * op(A) x + beta * y for a row-major m x n matrix A. The plain product splits the
+// rows over the workers; the transposed product splits the columns so every worker streams
+// its slice of each row and no reduction across workers is needed.
+template <typename T>
+void gemv(size_t m, size_t n, T alpha, const T* a, size_t lda, bool trans, const T* x, T beta, T* y) {
+    if (!trans) {
+        parallel_for(m, 64, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                T v = alpha * dot(a + i * lda, x, n);
+                y[i] = beta == T(0) ? v : v + beta * y[i];
+            }
+        });
+        return;
+    }
+    parallel_for(n, 1024, [&](size_t, size_t begin, size_t end) {
+        size_t len = end - begin;
+        for (size_t j = begin; j < end; j++) y[j] = beta == T(0) ? T(0) : beta * y[j];
+        for (size_t i = 0; i < m; i++) axpy(alpha * x[i], a + i * lda + begin, y + begin, len);
+    });
+}
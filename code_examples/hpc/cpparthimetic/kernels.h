@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "parallel.h"
+#include "simd.h"
+#include "vector.h"
+
+SIMD_CLONES inline void add_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = a[i] + b[i];
+}
+
+SIMD_CLONES inline void mul_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = a[i] * b[i];
+}
+
+SIMD_CLONES inline void div_kernel(const double* a, const double* b, double* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = a[i] / b[i];
+}
+
+// Same operation with non-temporal stores, for outputs too large to be worth caching.
+template <typename Op>
+void stream_kernel(const double* a, const double* b, double* c, size_t n) {
+    Op op;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i < n && (reinterpret_cast<uintptr_t>(c + i) & 15); i++) c[i] = op(a[i], b[i]);
+    for (; i + 2 <= n; i += 2) _mm_stream_pd(c + i, _mm_set_pd(op(a[i + 1], b[i + 1]), op(a[i], b[i])));
+    _mm_sfence();
+#endif
+    for (; i < n; i++) c[i] = op(a[i], b[i]);
+}
+
+typedef void (*binary_kernel)(const double*, const double*, double*, size_t);
+
+struct BinaryOp {
+    binary_kernel regular, streaming;
+};
+
+const BinaryOp add_op = {add_kernel, stream_kernel<std::plus<double>>};
+const BinaryOp mul_op = {mul_kernel, stream_kernel<std::multiplies<double>>};
+const BinaryOp div_op = {div_kernel, stream_kernel<std::divides<double>>};
+
+// How elementwise kernels are run; chosen per host by the autotuner (autotune.h).
+struct ElementwiseParams {
+    size_t threads = 0;             // 0: one per hardware thread
+    size_t grain = 1 << 15;         // minimum elements per chunk
+    size_t threshold = 1 << 15;     // below this many elements, run on the calling thread
+    size_t stream_min = 0;          // outputs of at least this many elements use streaming stores; 0: never
+};
+
+inline void elementwise_into(const Vector& a, const Vector& b, Vector& c, const BinaryOp& op, const ElementwiseParams& p) {
+    size_t n = a.size();
+    binary_kernel kernel = p.stream_min && n >= p.stream_min ? op.streaming : op.regular;
+    if (n < p.threshold) {
+        kernel(a.data(), b.data(), c.data(), n);
+        return;
+    }
+    parallel_for(n, p.grain, [&](size_t, size_t begin, size_t end) {
+        kernel(a.data() + begin, b.data() + begin, c.data() + begin, end - begin);
+    }, p.threads);
+}
+
+// c = a op b into a freshly allocated vector.
+inline Vector elementwise(const Vector& a, const Vector& b, const BinaryOp& op, const ElementwiseParams& p) {
+    if (a.size() != b.size()) throw std::invalid_argument("input vectors must have the same length");
+    Vector c(a.size());
+    elementwise_into(a, b, c, op, p);
+    return c;
+}
+
+// A run of doubles stride elements apart; negative strides walk backwards (reversed views).
+struct Strided {
+    const double* data;
+    ptrdiff_t stride;
+};
+
+// Elements per gathered tile: two input tiles and the output stay in L1.
+const size_t strided_tile = 512;
+
+// Copy n strided elements into dst. Strides spanning a cache line or more prefetch ahead, since
+// every element then costs its own line.
+SIMD_CLONES inline void gather_strided(const double* src, ptrdiff_t stride, double* dst, size_t n) {
+    if (stride >= 8 || stride <= -8) {
+        for (size_t i = 0; i < n; i++) {
+            __builtin_prefetch(src + (ptrdiff_t(i) + 16) * stride);
+            dst[i] = src[ptrdiff_t(i) * stride];
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; i++) dst[i] = src[ptrdiff_t(i) * stride];
+}
+
+// c[i] = a[i] op b[i] for strided inputs and a contiguous output. Unit-stride inputs go straight
+// to the SIMD kernel; the others are gathered tile by tile, reading only the elements used.
+inline void strided_into(Strided a, Strided b, double* c, size_t n, const BinaryOp& op) {
+    if (a.stride == 1 && b.stride == 1) {
+        op.regular(a.data, b.data, c, n);
+        return;
+    }
+    double ta[strided_tile], tb[strided_tile];
+    for (size_t i = 0; i < n; i += strided_tile) {
+        size_t m = std::min(strided_tile, n - i);
+        const double* pa = a.data + ptrdiff_t(i) * a.stride;
+        const double* pb = b.data + ptrdiff_t(i) * b.stride;
+        if (a.stride != 1) {
+            gather_strided(pa, a.stride, ta, m);
+            pa = ta;
+        }
+        if (b.stride != 1) {
+            gather_strided(pb, b.stride, tb, m);
+            pb = tb;
+        }
+        op.regular(pa, pb, c + i, m);
+    }
+}
+
+inline Vector elementwise_strided(Strided a, Strided b, size_t n, const BinaryOp& op, const ElementwiseParams& p) {
+    Vector c(n);
+    bool contiguous = a.stride == 1 && b.stride == 1;
+    binary_kernel kernel = p.stream_min && n >= p.stream_min ? op.streaming : op.regular;
+    auto run = [&](size_t begin, size_t end) {
+        Strided sa = {a.data + ptrdiff_t(begin) * a.stride, a.stride};
+        Strided sb = {b.data + ptrdiff_t(begin) * b.stride, b.stride};
+        if (contiguous) {
+            kernel(sa.data, sb.data, c.data() + begin, end - begin);
+        } else {
+            strided_into(sa, sb, c.data() + begin, end - begin, op);
+        }
+    };
+    if (n < p.threshold) {
+        run(0, n);
+        return c;
+    }
+    parallel_for(n, p.grain, [&](size_t, size_t begin, size_t end) { run(begin, end); }, p.threads);
+    return c;
+}
@@ -4,29 +4,956 @@
 #include <numeric>
 #include <functional>
 #include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+
+#include "arrow.h"
+#include "autotune.h"
+#include "batch.h"
+#include "bitmask.h"
+#include "buffers.h"
+#include "caster.h"
+#include "codec.h"
+#include "complex.h"
+#include "expr.h"
+#include "gather.h"
+#include "gemm.h"
+#include "kernels.h"
+#include "mapping.h"
+#include "reduce.h"
+#include "saturate.h"
+#include "segment.h"
+#include "shuffle.h"
+#include "sketch.h"
+#include "sort.h"
+#include "stream.h"
+#include "vector.h"
 
 using dvec = std::vector<double>;
 
+void check_lengths(const dvec& a, const dvec& b) {
+    if (a.size() != b.size()) throw std::invalid_argument("input lists must have the same length");
+}
+
 dvec vecadd(const dvec& a, const dvec& b) {
-    dvec c;
-    std::transform(a.begin(), a.end(), b.begin(), std::back_inserter(c), std::plus<double>());
+    check_lengths(a, b);
+    dvec c(a.size());
+    std::transform(a.begin(), a.end(), b.begin(), c.begin(), std::plus<double>());
     return c;
 }
 
 dvec vecmul(const dvec& a, const dvec& b) {
-    dvec c;
-    std::transform(a.begin(), a.end(), b.begin(), std::back_inserter(c), std::multiplies<double>());
+    check_lengths(a, b);
+    dvec c(a.size());
+    std::transform(a.begin(), a.end(), b.begin(), c.begin(), std::multiplies<double>());
     return c;
 }
 
 dvec vecdiv(const dvec& a, const dvec& b) {
-    dvec c;
-    std::transform(a.begin(), a.end(), b.begin(), std::back_inserter(c), std::divides<double>());
+    check_lengths(a, b);
+    dvec c(a.size());
+    std::transform(a.begin(), a.end(), b.begin(), c.begin(), std::divides<double>());
     return c;
 }
 
+template <typename T>
+void sort_buffer(py::buffer values) {
+    Span<T> v(values, "sort", true);
+    radix_sort(v.data, v.size);
+}
+
+template <typename T>
+void argsort_buffer(py::buffer values, py::buffer out) {
+    Span<T> v(values, "argsort");
+    Span<int64_t> idx(out, "argsort", true);
+    if (idx.size != v.size) throw py::value_error("argsort: output length must match input length");
+    argsort(v.data, idx.data, v.size);
+}
+
+template <typename T>
+std::pair<std::vector<T>, std::vector<int64_t>> topk_buffer(py::buffer values, size_t k, bool largest) {
+    Span<T> v(values, "topk");
+    std::pair<std::vector<T>, std::vector<int64_t>> result;
+    for (auto& e : topk(v.data, v.size, k, largest)) {
+        result.first.push_back(e.first);
+        result.second.push_back(e.second);
+    }
+    return result;
+}
+
+template <typename T>
+void gemm_buffer(py::buffer a, py::buffer b, py::buffer c, double alpha, double beta, bool trans_a, bool trans_b) {
+    MatrixSpan<T> ma(a, "gemm"), mb(b, "gemm"), mc(c, "gemm", true);
+    size_t m = trans_a ? ma.cols : ma.rows, k = trans_a ? ma.rows : ma.cols;
+    size_t kb = trans_b ? mb.cols : mb.rows, n = trans_b ? mb.rows : mb.cols;
+    if (k != kb || mc.rows != m || mc.cols != n) throw py::value_error("gemm: incompatible matrix shapes");
+    gemm<T>(m, n, k, T(alpha), {ma.data, ma.ld, trans_a}, {mb.data, mb.ld, trans_b}, T(beta), mc.data, mc.ld);
+}
+
+template <typename T>
+void gemv_buffer(py::buffer a, py::buffer x, py::buffer y, double alpha, double beta, bool trans) {
+    MatrixSpan<T> ma(a, "gemv");
+    Span<T> vx(x, "gemv"), vy(y, "gemv", true);
+    if (vx.size != (trans ? ma.rows : ma.cols) || vy.size != (trans ? ma.cols : ma.rows)) {
+        throw py::value_error("gemv: incompatible shapes");
+    }
+    gemv<T>(ma.rows, ma.cols, T(alpha), ma.data, ma.ld, trans, vx.data, T(beta), vy.data);
+}
+
+// Serializes calls on one or two Python objects when CPython runs without the GIL (a no-op with
+// it). Sketches update in place, and a TDigest compresses its buffer even on reads.
+class ObjectLock {
+#ifdef Py_GIL_DISABLED
+    PyCriticalSection2 section;
+
+public:
+    explicit ObjectLock(py::handle a, py::handle b = py::handle()) {
+        PyCriticalSection2_Begin(&section, a.ptr(), b ? b.ptr() : a.ptr());
+    }
+    ~ObjectLock() { PyCriticalSection2_End(&section); }
+#else
+public:
+    explicit ObjectLock(py::handle, py::handle = py::handle()) {}
+#endif
+    ObjectLock(const ObjectLock&) = delete;
+    ObjectLock& operator=(const ObjectLock&) = delete;
+};
+
+// Method and field bindings that hold the object's lock for the call.
+template <typename S, typename R, typename... Args>
+auto locked(R (S::*method)(Args...)) {
+    return [method](py::object self, Args... args) -> R {
+        ObjectLock lock(self);
+        return (self.cast<S&>().*method)(args...);
+    };
+}
+
+template <typename S, typename R, typename... Args>
+auto locked(R (S::*method)(Args...) const) {
+    return [method](py::object self, Args... args) -> R {
+        ObjectLock lock(self);
+        return (self.cast<const S&>().*method)(args...);
+    };
+}
+
+template <typename S, typename T>
+auto locked_field(T S::*field) {
+    return [field](py::object self) -> T {
+        ObjectLock lock(self);
+        return self.cast<const S&>().*field;
+    };
+}
+
+// update(values) and merge(other) for a sketch type, under the locks of the objects involved.
+template <typename S, typename C>
+void def_sketch_updates(C& cls, const char* merge_doc) {
+    cls.def("update", [](py::object self, py::buffer values) {
+        Span<double> v(values, "update");
+        ObjectLock lock(self);
+        self.cast<S&>().update(v.data, v.size);
+    }, "Add the values of a float64 buffer", py::arg("values"));
+    cls.def("merge", [](py::object self, py::object other) {
+        if (!py::isinstance<S>(other)) throw py::type_error("merge: other must be a sketch of the same type");
+        ObjectLock lock(self, other);
+        self.cast<S&>().merge(other.cast<const S&>());
+    }, merge_doc, py::arg("other"));
+}
+
+// Serialized bytes are the pickled state, so sketches travel between electrons compactly.
+template <typename S, typename C>
+void def_sketch_io(C& cls) {
+    cls.def("to_bytes", [](py::object self) { return py::bytes(locked(&S::serialize)(self)); }, "Serialize the sketch");
+    cls.def_static("from_bytes", [](const py::bytes& b) { return S::deserialize(b); }, "Restore a serialized sketch");
+    cls.def(py::pickle([](py::object self) { return py::bytes(locked(&S::serialize)(self)); },
+                       [](const py::bytes& b) { return S::deserialize(b); }));
+}
+
+py::buffer_info vector_buffer(Vector& v) {
+    return py::buffer_info(v.data(), sizeof(double), py::format_descriptor<double>::format(), 1,
+                           {py::ssize_t(v.size())}, {py::ssize_t(sizeof(double))}, v.readonly());
+}
+
+// Bytes-like input (bytes, bytearray, memoryview, mmap) without copying it.
+Vector decompress_buffer(const py::buffer& data, size_t start, size_t stop) {
+    py::buffer_info info = data.request();
+    return decompress(static_cast<const uint8_t*>(info.ptr), size_t(info.size * info.itemsize), start, stop);
+}
+
+// Vectors pickle as compressed containers of their own elements, spilled or not, so an unpickled
+// vector never aliases the original and can be loaded on any node. Spill files are shared only
+// through Vector.spill_handle() and map_spill().
+py::object vector_state(const Vector& v) {
+    return py::bytes(compress(v, "auto", 1 << 16));
+}
+
+Vector vector_from_state(const py::object& state) {
+    std::string raw = state.cast<py::bytes>();
+    if (raw.compare(0, 4, "CPV1") == 0) {
+        return decompress(reinterpret_cast<const uint8_t*>(raw.data()), raw.size(), 0, SIZE_MAX);
+    }
+    Vector v(raw.size() / sizeof(double));
+    std::memcpy(v.data(), raw.data(), v.size() * sizeof(double));
+    return v;
+}
+
+// Elementwise op over two 1-D buffers of any stride. float64 buffers are read in place; other
+// element types are converted once.
+Vector elementwise_buffers(py::buffer a, py::buffer b, const BinaryOp& op, const char* name) {
+    if (!format_is<double>(a.request()) || !format_is<double>(b.request())) {
+        Vector x = convert_vector(a), y = convert_vector(b);
+        if (x.size() != y.size()) throw py::value_error(std::string(name) + ": inputs must have the same length");
+        py::gil_scoped_release release;
+        return elementwise(x, y, op, tuned_params());
+    }
+    StridedSpan<double> x(a, name), y(b, name);
+    if (x.size != y.size) throw py::value_error(std::string(name) + ": inputs must have the same length");
+    py::gil_scoped_release release;
+    return elementwise_strided({x.data, x.stride}, {y.data, y.stride}, x.size, op, tuned_params());
+}
+
+// out[i] = a[i] op b[i] where the mask is set; out is left untouched elsewhere. Without out, a new
+// zero-filled vector is written and returned.
+template <typename Op>
+py::object masked_buffers(py::object a, py::object b, py::object where, py::object out, const char* name) {
+    Vector x = as_vector(a, name), y = as_vector(b, name);
+    if (x.size() != y.size()) throw py::value_error(std::string(name) + ": inputs must have the same length");
+    MaskBuffer mask(where, x.size(), name);
+    if (out.is_none()) {
+        Vector c(x.size());
+        std::fill(c.data(), c.data() + c.size(), 0.0);
+        out = py::cast(c);
+    }
+    Vector c = output_vector(out, name, "out");
+    if (c.size() != x.size()) throw py::value_error(std::string(name) + ": out must have the same length as the inputs");
+    {
+        py::gil_scoped_release release;
+        masked_elementwise<Op>(x.data(), y.data(), c.data(), mask.mask, x.size(), tuned_params());
+    }
+    return out;
+}
+
+// A new writable buffer of n elements with the given struct format: a memoryview over a bytearray.
+py::object new_typed_buffer(char format, size_t n, size_t itemsize) {
+    py::object bytes = py::reinterpret_steal<py::object>(PyByteArray_FromStringAndSize(nullptr, py::ssize_t(n * itemsize)));
+    if (!bytes) throw py::error_already_set();
+    return py::memoryview(bytes).attr("cast")(std::string(1, format));
+}
+
+template <typename Op, typename T>
+py::object saturating_typed(py::buffer a, py::buffer b, py::object out, const char* name) {
+    Span<T> x(a, name), y(b, name);
+    if (x.size != y.size) throw py::value_error(std::string(name) + ": inputs must have the same length");
+    if (out.is_none()) out = new_typed_buffer(x.info.format.back(), x.size, sizeof(T));
+    Span<T> z(out.cast<py::buffer>(), name, true);
+    if (z.size != x.size) throw py::value_error(std::string(name) + ": out must have the same length as the inputs");
+    saturating<T, Op>(x.data, y.data, z.data, x.size, tuned_params());
+    return out;
+}
+
+// Saturating op on int8, uint8, int16 or uint16 buffers (both inputs and out of the same type).
+template <typename Op>
+py::object saturating_buffers(py::buffer a, py::buffer b, py::object out, const char* name) {
+    py::buffer_info info = a.request();
+    if (format_is<int8_t>(info)) return saturating_typed<Op, int8_t>(a, b, out, name);
+    if (format_is<uint8_t>(info)) return saturating_typed<Op, uint8_t>(a, b, out, name);
+    if (format_is<int16_t>(info)) return saturating_typed<Op, int16_t>(a, b, out, name);
+    if (format_is<uint16_t>(info)) return saturating_typed<Op, uint16_t>(a, b, out, name);
+    throw py::type_error(std::string(name) + ": unsupported element type '" + info.format + "'");
+}
+
+// A complex operand: a (re, im) pair of float64 vectors (split layout), a complex128 buffer, or a
+// float64 vector of interleaved (re, im) pairs.
+struct ComplexArg {
+    std::unique_ptr<ComplexSpan> span;
+    Vector re, im;
+    ComplexRef ref;
+    size_t size;
+};
+
+ComplexArg complex_arg(const py::handle& obj, const char* name) {
+    ComplexArg arg;
+    if (py::isinstance<py::tuple>(obj)) {
+        py::tuple parts = py::reinterpret_borrow<py::tuple>(obj);
+        if (parts.size() != 2) throw py::value_error(std::string(name) + ": split complex input must be a (re, im) pair");
+        arg.re = as_vector(parts[0], name);
+        arg.im = as_vector(parts[1], name);
+        if (arg.re.size() != arg.im.size()) throw py::value_error(std::string(name) + ": re and im must have the same length");
+        arg.ref = {arg.re.data(), arg.im.data(), 1};
+        arg.size = arg.re.size();
+    } else if (PyObject_CheckBuffer(obj.ptr()) && ComplexSpan::is_complex128(py::reinterpret_borrow<py::buffer>(obj).request())) {
+        arg.span.reset(new ComplexSpan(py::reinterpret_borrow<py::buffer>(obj), name));
+        arg.ref = {arg.span->data, arg.span->data + 1, 2};
+        arg.size = arg.span->size;
+    } else {
+        arg.re = as_vector(obj, name);
+        if (arg.re.size() % 2) throw py::value_error(std::string(name) + ": interleaved input needs an even length");
+        arg.ref = {arg.re.data(), arg.re.data() + 1, 2};
+        arg.size = arg.re.size() / 2;
+    }
+    return arg;
+}
+
+// Split inputs give a (re, im) tuple of Vectors, interleaved inputs a Vector of (re, im) pairs.
+py::object complex_binary(py::object a, py::object b, const ComplexOp& op, const char* name) {
+    ComplexArg x = complex_arg(a, name), y = complex_arg(b, name);
+    if (x.ref.stride != y.ref.stride) throw py::value_error(std::string(name) + ": inputs must use the same layout");
+    if (x.size != y.size) throw py::value_error(std::string(name) + ": inputs must have the same length");
+    if (x.ref.stride == 1) {
+        Vector re(x.size), im(x.size);
+        complex_elementwise(x.ref, y.ref, re.data(), im.data(), x.size, op, tuned_params());
+        return py::make_tuple(re, im);
+    }
+    Vector c(2 * x.size);
+    complex_elementwise(x.ref, y.ref, c.data(), nullptr, x.size, op, tuned_params());
+    return py::cast(c);
+}
+
+// Run a compiled expression; values maps each variable to a vector-like or a number (broadcast).
+Vector evaluate_program(const expr::Program& prog, const py::dict& values) {
+    size_t nvars = prog.variables.size(), n = 0;
+    bool sized = false;
+    std::vector<Vector> arrays(nvars);
+    std::vector<double> scalars(nvars);
+    std::vector<const double*> inputs(nvars);
+    std::vector<size_t> strides(nvars);
+    for (size_t k = 0; k < nvars; k++) {
+        const std::string& name = prog.variables[k];
+        if (!values.contains(name)) throw py::value_error("evaluate: no value for variable '" + name + "'");
+        py::handle v = values[name.c_str()];
+        if (py::isinstance<py::float_>(v) || py::isinstance<py::int_>(v)) {
+            scalars[k] = v.cast<double>();
+            inputs[k] = &scalars[k];
+            strides[k] = 0;
+            continue;
+        }
+        arrays[k] = as_vector(v, "evaluate");
+        if (sized && arrays[k].size() != n) throw py::value_error("evaluate: inputs must have the same length");
+        n = arrays[k].size();
+        sized = true;
+        inputs[k] = arrays[k].data();
+        strides[k] = 1;
+    }
+    Vector out(sized ? n : 1);
+    expr::evaluate(prog, inputs.data(), strides.data(), out.data(), out.size(), tuned_params());
+    return out;
+}
+
+// int64 offsets or keys: an int64 buffer is read in place, any other sequence of integers is copied.
+struct Int64Arg {
+    std::unique_ptr<Span<int64_t>> span;
+    std::vector<int64_t> copy;
+    const int64_t* data;
+    size_t size;
+
+    Int64Arg(const py::handle& obj, const char* name) {
+        if (PyObject_CheckBuffer(obj.ptr()) && format_is<int64_t>(py::reinterpret_borrow<py::buffer>(obj).request())) {
+            span.reset(new Span<int64_t>(py::reinterpret_borrow<py::buffer>(obj), name));
+            data = span->data;
+            size = span->size;
+        } else {
+            copy = obj.cast<std::vector<int64_t>>();
+            data = copy.data();
+            size = copy.size();
+        }
+    }
+};
+
+// Shuffle a Vector or any writable contiguous buffer in place. Elements are moved as raw words of
+// their item size, so the element type itself does not matter.
+void shuffle_values(py::object values, uint64_t seed, uint64_t epoch) {
+    if (py::isinstance<Vector>(values)) {
+        Vector v = values.cast<Vector>();
+        if (v.readonly()) throw py::type_error("shuffle: Vector is read-only");
+        parallel_shuffle(v.data(), v.size(), seed, epoch);
+        return;
+    }
+    if (!PyObject_CheckBuffer(values.ptr())) throw py::type_error("shuffle: expected a Vector or a writable buffer");
+    py::buffer_info info = values.cast<py::buffer>().request(true);
+    if (info.ndim != 1 || (info.shape[0] > 1 && info.strides[0] != info.itemsize)) {
+        throw py::value_error("shuffle: expected a contiguous one dimensional buffer");
+    }
+    size_t n = size_t(info.shape[0]);
+    switch (info.itemsize) {
+        case 1: parallel_shuffle(static_cast<uint8_t*>(info.ptr), n, seed, epoch); break;
+        case 2: parallel_shuffle(static_cast<uint16_t*>(info.ptr), n, seed, epoch); break;
+        case 4: parallel_shuffle(static_cast<uint32_t*>(info.ptr), n, seed, epoch); break;
+        case 8: parallel_shuffle(static_cast<uint64_t*>(info.ptr), n, seed, epoch); break;
+        default: throw py::type_error("shuffle: unsupported item size " + std::to_string(info.itemsize));
+    }
+}
+
+// Bitmask of a cmp b, where b is a vector of the same length or a number.
+template <typename Cmp>
+Bitmask compare_with(py::object a, py::object b, Cmp cmp, const char* name) {
+    Vector x = as_vector(a, name);
+    if (py::isinstance<py::float_>(b) || py::isinstance<py::int_>(b)) {
+        Against<Cmp> pred{cmp, b.cast<double>()};
+        py::gil_scoped_release release;
+        return predicate(x.data(), x.size(), pred, tuned_params());
+    }
+    Vector y = as_vector(b, name);
+    if (x.size() != y.size()) throw py::value_error(std::string(name) + ": inputs must have the same length");
+    py::gil_scoped_release release;
+    return compare(x.data(), y.data(), x.size(), cmp, tuned_params());
+}
+
+Bitmask compare_values(py::object a, py::object b, const std::string& op) {
+    if (op == "<") return compare_with(a, b, std::less<double>(), "compare");
+    if (op == "<=") return compare_with(a, b, std::less_equal<double>(), "compare");
+    if (op == ">") return compare_with(a, b, std::greater<double>(), "compare");
+    if (op == ">=") return compare_with(a, b, std::greater_equal<double>(), "compare");
+    if (op == "==") return compare_with(a, b, std::equal_to<double>(), "compare");
+    if (op == "!=") return compare_with(a, b, std::not_equal_to<double>(), "compare");
+    throw py::value_error("unknown comparison '" + op + "' (expected <, <=, >, >=, == or !=)");
+}
+
+template <typename Pred>
+Bitmask predicate_values(py::object values, Pred pred, const char* name) {
+    Vector x = as_vector(values, name);
+    py::gil_scoped_release release;
+    return predicate(x.data(), x.size(), pred, tuned_params());
+}
+
+// The packed words as a read-only uint64 buffer, for numpy and other buffer consumers.
+py::buffer_info bitmask_buffer(Bitmask& m) {
+    return py::buffer_info(m.data(), sizeof(uint64_t), py::format_descriptor<uint64_t>::format(), 1,
+                           {py::ssize_t(m.word_count())}, {py::ssize_t(sizeof(uint64_t))}, true);
+}
+
+// The elements of values whose mask entry is set, in order, as a new vector.
+Vector select_values(py::object values, py::object where) {
+    Vector x = as_vector(values, "select");
+    MaskBuffer mask(where, x.size(), "select");
+    py::gil_scoped_release release;
+    Vector out(mask_count(mask.mask, x.size()));
+    compact(x.data(), mask.mask, x.size(), out.data(), tuned_params());
+    return out;
+}
+
+// vecadd_stream and friends: an iterator of result chunks, or with out= the number of elements
+// passed to the sink.
+py::object binary_stream(py::iterable a, py::iterable b, size_t chunk_size, py::object out, const BinaryOp& op,
+                         const char* name) {
+    BinaryStream stream(a, b, op, chunk_size, name);
+    if (out.is_none()) return py::cast(std::move(stream));
+    return py::int_(stream.drain(out));
+}
+
+SegmentOp segment_op(const std::string& op) {
+    if (op == "sum") return SegmentOp::sum;
+    if (op == "min") return SegmentOp::min;
+    if (op == "max") return SegmentOp::max;
+    if (op == "mean") return SegmentOp::mean;
+    throw py::value_error("unknown segment op '" + op + "' (expected sum, min, max or mean)");
+}
+
+py::dict tuning_dict(const ElementwiseParams& p) {
+    char host[256];
+    tuning_host_key(host, sizeof(host));
+    py::dict d;
+    d["host"] = std::string(host);
+    d["source"] = autotuner().source.load();
+    d["threads"] = p.threads ? p.threads : hardware_workers();
+    d["grain"] = p.grain;
+    d["parallel_threshold"] = p.threshold;
+    d["stream_min"] = p.stream_min;
+    return d;
+}
+
+// Import cost, for diagnostics(): when the dynamic loader ran this library's static
+// initializers, and how long the module body then took. Everything else (worker pool, CPU
+// probing, tuning, kernel tables) starts on first use.
+const double library_loaded = tuning_now();
+double module_init_seconds = 0, module_ready = 0;
+
+py::dict diagnostics() {
+    py::dict d, cpu;
+    d["import_ms"] = module_init_seconds * 1e3;
+    d["load_to_ready_ms"] = (module_ready - library_loaded) * 1e3;
+    bool started = __atomic_load_n(&ws_pool->started, __ATOMIC_ACQUIRE);
+    d["pool_started"] = started;
+    d["pool_threads"] = started ? __atomic_load_n(&ws_pool->workers, __ATOMIC_ACQUIRE) + 1 : 0;
+    if (cpu_probed()) {
+        const CpuFeatures& f = cpu_features();
+        cpu["ssse3"] = f.ssse3;
+        cpu["avx2"] = f.avx2;
+        cpu["avx512f"] = f.avx512f;
+        d["cpu_features"] = cpu;
+    } else {
+        d["cpu_features"] = py::none();
+    }
+    d["tuned"] = autotuner().ready.load();
+    return d;
+}
+
+// Safe without the GIL: module state is atomics or mutex guarded, sketches lock per object, and
+// vecadd/vecmul/vecdiv release the GIL around their kernels on GIL builds too.
+#if PYBIND11_VERSION_HEX >= 0x020D0000
+PYBIND11_MODULE(cpparthimetic, m, py::mod_gil_not_used()) {
+#else
 PYBIND11_MODULE(cpparthimetic, m) {
-    m.def("vecadd", &vecadd, "Add two python lists");
-    m.def("vecmul", &vecmul, "Multiply two python lists");
-    m.def("vecdiv", &vecdiv, "Divide two python lists elementwise");
-}
\ No newline at end of file
+#endif
+    double init_start = tuning_now();
+    if (ws_share_pool() != 0) throw py::error_already_set();
+    py::class_<Vector>(m, "Vector", py::buffer_protocol(),
+                       "float64 vector in native memory; slices and shards are views that pickle only their own elements")
+        .def(py::init([](py::object values) { return merge({as_vector(values, "Vector")}); }),
+             "Copy a sequence or float64 buffer into a new vector", py::arg("values"))
+        .def_static("wrap", [](py::buffer values) { return as_vector(values, "Vector.wrap"); },
+                    "View a contiguous float64 buffer without copying it", py::arg("values"))
+        .def_buffer(&vector_buffer)
+        .def("__len__", &Vector::size)
+        .def("__getitem__", [](const Vector& v, py::ssize_t i) {
+            if (i < 0) i += py::ssize_t(v.size());
+            if (i < 0 || size_t(i) >= v.size()) throw py::index_error("Vector index out of range");
+            return v.data()[i];
+        })
+        .def("__getitem__", [](const Vector& v, const py::slice& s) {
+            size_t start, stop, step, count;
+            if (!s.compute(v.size(), &start, &stop, &step, &count)) throw py::error_already_set();
+            if (step == 1) return v.slice(start, start + count);
+            Vector out(count);
+            for (size_t i = 0; i < count; i++) out.data()[i] = v.data()[start + i * step];
+            return out;
+        }, "Slices with step 1 are views, other slices are copies")
+        .def("__setitem__", [](Vector& v, py::ssize_t i, double value) {
+            if (v.readonly()) throw py::type_error("Vector is read-only");
+            if (i < 0) i += py::ssize_t(v.size());
+            if (i < 0 || size_t(i) >= v.size()) throw py::index_error("Vector index out of range");
+            v.data()[i] = value;
+        })
+        .def("tolist", [](const Vector& v) { return dvec(v.data(), v.data() + v.size()); })
+        .def_property_readonly("offset", &Vector::offset, "Start of this view within its storage")
+        .def_property_readonly("file", [](const Vector& v) -> py::object {
+            std::string path = backing_file(v);
+            return path.empty() ? py::object(py::none()) : py::object(py::str(path));
+        }, "Path of the spill or mapped file behind this vector, or None")
+        .def("spill_handle", [](const Vector& v) {
+            auto spill = dynamic_cast<SpillStorage*>(v.storage().get());
+            if (!spill) throw py::value_error("spill_handle: vector is not backed by a spill file");
+            return py::make_tuple(spill->path, v.offset(), v.size());
+        }, "(path, offset, length) of this view's spill file, for map_spill in another process on this node. The "
+           "file is deleted when the last vector using it here is freed, so keep this vector alive until the "
+           "receiver has mapped it")
+        .def(py::pickle(&vector_state, &vector_from_state));
+
+    m.def("vecadd", [](const Vector& a, const Vector& b) { return elementwise_batched(a, b, add_op); },
+          py::call_guard<py::gil_scoped_release>());
+    m.def("vecadd", [](py::buffer a, py::buffer b) { return elementwise_buffers(a, b, add_op, "vecadd"); });
+    m.def("vecadd", [](py::object a, py::object b, py::object where, py::object out) {
+        return masked_buffers<MaskedAdd>(a, b, where, out, "vecadd");
+    }, "Elementwise where= form: only elements whose mask is set are written",
+       py::arg("a"), py::arg("b"), py::kw_only(), py::arg("where"), py::arg("out") = py::none());
+    m.def("vecadd", &vecadd, "Add two python lists", py::call_guard<py::gil_scoped_release>());
+    m.def("vecmul", [](const Vector& a, const Vector& b) { return elementwise_batched(a, b, mul_op); },
+          py::call_guard<py::gil_scoped_release>());
+    m.def("vecmul", [](py::buffer a, py::buffer b) { return elementwise_buffers(a, b, mul_op, "vecmul"); });
+    m.def("vecmul", [](py::object a, py::object b, py::object where, py::object out) {
+        return masked_buffers<MaskedMul>(a, b, where, out, "vecmul");
+    }, "Elementwise where= form: only elements whose mask is set are written",
+       py::arg("a"), py::arg("b"), py::kw_only(), py::arg("where"), py::arg("out") = py::none());
+    m.def("vecmul", &vecmul, "Multiply two python lists", py::call_guard<py::gil_scoped_release>());
+    m.def("vecdiv", [](const Vector& a, const Vector& b) { return elementwise_batched(a, b, div_op); },
+          py::call_guard<py::gil_scoped_release>());
+    m.def("vecdiv", [](py::buffer a, py::buffer b) { return elementwise_buffers(a, b, div_op, "vecdiv"); });
+    m.def("vecdiv", [](py::object a, py::object b, py::object where, py::object out) {
+        return masked_buffers<MaskedDiv>(a, b, where, out, "vecdiv");
+    }, "Elementwise where= form: only elements whose mask is set are written",
+       py::arg("a"), py::arg("b"), py::kw_only(), py::arg("where"), py::arg("out") = py::none());
+    m.def("vecdiv", &vecdiv, "Divide two python lists elementwise", py::call_guard<py::gil_scoped_release>());
+
+    py::class_<BinaryStream>(m, "BinaryStream", "Iterator of result chunks from vecadd_stream, vecmul_stream or vecdiv_stream")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", [](py::object self) {
+            ObjectLock lock(self);
+            return self.cast<BinaryStream&>().next();
+        });
+    const char* stream_doc = "Apply the op to two iterables of numbers chunk_size pairs at a time, yielding a Vector per "
+                             "chunk; with out=, pass each chunk to that callable instead and return the element count";
+    m.def("vecadd_stream", [](py::iterable a, py::iterable b, size_t chunk_size, py::object out) {
+        return binary_stream(a, b, chunk_size, out, add_op, "vecadd_stream");
+    }, stream_doc, py::arg("a"), py::arg("b"), py::arg("chunk_size") = 65536, py::kw_only(), py::arg("out") = py::none());
+    m.def("vecmul_stream", [](py::iterable a, py::iterable b, size_t chunk_size, py::object out) {
+        return binary_stream(a, b, chunk_size, out, mul_op, "vecmul_stream");
+    }, stream_doc, py::arg("a"), py::arg("b"), py::arg("chunk_size") = 65536, py::kw_only(), py::arg("out") = py::none());
+    m.def("vecdiv_stream", [](py::iterable a, py::iterable b, size_t chunk_size, py::object out) {
+        return binary_stream(a, b, chunk_size, out, div_op, "vecdiv_stream");
+    }, stream_doc, py::arg("a"), py::arg("b"), py::arg("chunk_size") = 65536, py::kw_only(), py::arg("out") = py::none());
+
+    py::class_<Bitmask>(m, "Bitmask", py::buffer_protocol(),
+                        "Packed result of a comparison: element i is bit i % 64 of uint64 word i / 64")
+        .def_buffer(&bitmask_buffer)
+        .def("__len__", &Bitmask::size)
+        .def("__getitem__", [](const Bitmask& b, py::ssize_t i) {
+            if (i < 0) i += py::ssize_t(b.size());
+            if (i < 0 || size_t(i) >= b.size()) throw py::index_error("Bitmask index out of range");
+            return b.test(size_t(i));
+        })
+        .def("count", [](const Bitmask& b) { return count_bits(b.data(), b.word_count()); }, "Number of set elements")
+        .def("__and__", [](const Bitmask& a, const Bitmask& b) { return bitmask_logic(a, b, std::bit_and<uint64_t>()); },
+             py::is_operator())
+        .def("__or__", [](const Bitmask& a, const Bitmask& b) { return bitmask_logic(a, b, std::bit_or<uint64_t>()); },
+             py::is_operator())
+        .def("__xor__", [](const Bitmask& a, const Bitmask& b) { return bitmask_logic(a, b, std::bit_xor<uint64_t>()); },
+             py::is_operator())
+        .def("__invert__", &bitmask_not)
+        .def("tolist", [](const Bitmask& b) {
+            std::vector<bool> out(b.size());
+            for (size_t i = 0; i < b.size(); i++) out[i] = b.test(i);
+            return out;
+        });
+    m.def("compare", &compare_values, "Bitmask of a op b for op in <, <=, >, >=, == or !=; b may be a number",
+          py::arg("a"), py::arg("b"), py::arg("op"));
+    m.def("isfinite", [](py::object values) { return predicate_values(values, IsFinite(), "isfinite"); },
+          "Bitmask of the finite elements", py::arg("values"));
+    m.def("isnan", [](py::object values) { return predicate_values(values, IsNan(), "isnan"); },
+          "Bitmask of the NaN elements", py::arg("values"));
+    m.def("isclose", [](py::object a, py::object b, double tol) {
+        if (!(tol >= 0)) throw py::value_error("isclose: tol must be non-negative");
+        return compare_with(a, b, IsClose{tol}, "isclose");
+    }, "Bitmask of abs(a - b) <= tol; b may be a number", py::arg("a"), py::arg("b"), py::arg("tol"));
+    m.def("select", &select_values,
+          "Compact the elements whose mask entry is set into a new vector; the mask is a Bitmask or any where= buffer",
+          py::arg("values"), py::arg("where"));
+
+    m.def("split", [](py::object values, size_t parts) { return split(as_vector(values, "split"), parts); },
+          "Split a vector (or float64 buffer) into n contiguous views without copying",
+          py::arg("values"), py::arg("parts"));
+    m.def("merge", [](py::iterable parts) {
+        std::vector<Vector> vs;
+        for (py::handle part : parts) vs.push_back(as_vector(part, "merge"));
+        return merge(vs);
+    }, "Concatenate shards into one new vector, copying them into place in parallel", py::arg("parts"));
+
+    m.def("sort", [](py::buffer values) {
+        buffer_format(values) == 'f' ? sort_buffer<float>(values) : sort_buffer<double>(values);
+    }, "Sort a float64/float32 buffer in place (parallel radix sort)", py::arg("values"));
+    m.def("argsort", [](py::buffer values, py::buffer out) {
+        buffer_format(values) == 'f' ? argsort_buffer<float>(values, out) : argsort_buffer<double>(values, out);
+    }, "Write the stable ascending sort order of a float64/float32 buffer into an int64 buffer",
+       py::arg("values"), py::arg("out"));
+    m.def("topk", [](py::buffer values, size_t k, bool largest) -> py::object {
+        if (buffer_format(values) == 'f') return py::cast(topk_buffer<float>(values, k, largest));
+        return py::cast(topk_buffer<double>(values, k, largest));
+    }, "Return (values, indices) of the k largest (or smallest) elements of a buffer, best first",
+       py::arg("values"), py::arg("k"), py::arg("largest") = true);
+
+    m.def("sat_add", [](py::buffer a, py::buffer b, py::object out) {
+        return saturating_buffers<SatAdd>(a, b, out, "sat_add");
+    }, "Saturating a + b on int8/uint8/int16/uint16 buffers; returns out, or a new memoryview",
+       py::arg("a"), py::arg("b"), py::arg("out") = py::none());
+    m.def("sat_sub", [](py::buffer a, py::buffer b, py::object out) {
+        return saturating_buffers<SatSub>(a, b, out, "sat_sub");
+    }, "Saturating a - b on int8/uint8/int16/uint16 buffers; returns out, or a new memoryview",
+       py::arg("a"), py::arg("b"), py::arg("out") = py::none());
+    m.def("sat_mul", [](py::buffer a, py::buffer b, py::object out) {
+        return saturating_buffers<SatMul>(a, b, out, "sat_mul");
+    }, "Saturating a * b on int8/uint8/int16/uint16 buffers; returns out, or a new memoryview",
+       py::arg("a"), py::arg("b"), py::arg("out") = py::none());
+    m.def("q15_mul", [](py::buffer a, py::buffer b, py::object out) {
+        return saturating_typed<Q15Mul, int16_t>(a, b, out, "q15_mul");
+    }, "Rounded, saturating Q15 fixed-point product of two int16 buffers; returns out, or a new memoryview",
+       py::arg("a"), py::arg("b"), py::arg("out") = py::none());
+
+    m.def("cadd", [](py::object a, py::object b) { return complex_binary(a, b, cadd_op, "cadd"); },
+          "Complex a + b; inputs are complex128 buffers, interleaved float64 vectors or (re, im) pairs",
+          py::arg("a"), py::arg("b"));
+    m.def("cmul", [](py::object a, py::object b) { return complex_binary(a, b, cmul_op, "cmul"); },
+          "Complex a * b; inputs are complex128 buffers, interleaved float64 vectors or (re, im) pairs",
+          py::arg("a"), py::arg("b"));
+    m.def("cmul_conj", [](py::object a, py::object b) { return complex_binary(a, b, cmulconj_op, "cmul_conj"); },
+          "Complex a * conj(b); inputs are complex128 buffers, interleaved float64 vectors or (re, im) pairs",
+          py::arg("a"), py::arg("b"));
+    m.def("cdiv", [](py::object a, py::object b) { return complex_binary(a, b, cdiv_op, "cdiv"); },
+          "Complex a / b by Smith's scaled method; inputs are complex128 buffers, interleaved float64 vectors or (re, im) pairs",
+          py::arg("a"), py::arg("b"));
+    m.def("cabs", [](py::object a) {
+        ComplexArg x = complex_arg(a, "cabs");
+        Vector c(x.size);
+        complex_abs(x.ref, c.data(), x.size, tuned_params());
+        return c;
+    }, "Magnitudes of a complex vector, computed without overflow or underflow", py::arg("a"));
+
+    py::class_<expr::Program, std::shared_ptr<expr::Program>>(m, "Expression",
+        "An elementwise formula compiled to register bytecode, evaluated block-wise in one pass")
+        .def(py::init([](const std::string& text) { return std::const_pointer_cast<expr::Program>(expr::compile(text)); }),
+             py::arg("text"))
+        .def_property_readonly("text", [](const expr::Program& p) { return p.text; })
+        .def_property_readonly("variables", [](const expr::Program& p) { return p.variables; },
+                               "Variable names in order of first use")
+        .def("disassemble", &expr::Program::disassemble, "Bytecode listing")
+        .def("__call__", [](const expr::Program& p, py::kwargs values) { return evaluate_program(p, values); },
+             "Evaluate with each variable given as a keyword (a vector-like, or a number to broadcast)");
+    m.def("evaluate", [](const std::string& text, py::kwargs values) {
+        return evaluate_program(*expr::compile(text), values);
+    }, "Evaluate an elementwise expression such as '(a + b) / (c * c + 1)'; compiled programs are cached by text",
+       py::arg("expression"));
+
+    m.def("segment_reduce", [](py::object values, py::object offsets, const std::string& op) {
+        Vector v = as_vector(values, "segment_reduce");
+        Int64Arg off(offsets, "segment_reduce");
+        if (off.size == 0) throw py::value_error("segment_reduce: offsets must not be empty");
+        Vector out(off.size - 1);
+        segmented_reduce(v.data(), v.size(), off.data, off.size - 1, out.data(), segment_op(op));
+        return out;
+    }, "Per-segment sum, min, max or mean; segment s is values[offsets[s]:offsets[s + 1]]",
+       py::arg("values"), py::arg("offsets"), py::arg("op") = "sum");
+    m.def("segment_scan", [](py::object values, py::object offsets, const std::string& op) {
+        Vector v = as_vector(values, "segment_scan");
+        Int64Arg off(offsets, "segment_scan");
+        if (off.size == 0) throw py::value_error("segment_scan: offsets must not be empty");
+        Vector out(v.size());
+        segmented_scan(v.data(), v.size(), off.data, off.size - 1, out.data(), segment_op(op));
+        return out;
+    }, "Inclusive running sum, min or max that restarts at every segment offset",
+       py::arg("values"), py::arg("offsets"), py::arg("op") = "sum");
+    m.def("reduce_by_key", [](py::object keys, py::object values, const std::string& op) {
+        Int64Arg k(keys, "reduce_by_key");
+        Vector v = as_vector(values, "reduce_by_key");
+        if (k.size != v.size()) throw py::value_error("reduce_by_key: keys and values must have the same length");
+        std::vector<int64_t> offsets = key_offsets(k.data, k.size);
+        size_t runs = offsets.size() - 1;
+        Vector out(runs);
+        segmented_reduce(v.data(), v.size(), offsets.data(), runs, out.data(), segment_op(op));
+        py::object unique = new_typed_buffer('q', runs, sizeof(int64_t));
+        Span<int64_t> u(unique.cast<py::buffer>(), "reduce_by_key", true);
+        for (size_t r = 0; r < runs; r++) u.data[r] = k.data[offsets[r]];
+        return py::make_tuple(unique, out);
+    }, "Reduce each run of equal consecutive keys; returns (keys, results)",
+       py::arg("keys"), py::arg("values"), py::arg("op") = "sum");
+
+    m.def("take", [](py::object values, py::object indices) {
+        Vector src = as_vector(values, "take");
+        Int64Arg idx(indices, "take");
+        check_indices(idx.data, idx.size, src.size());
+        Vector out(idx.size);
+        take(src.data(), src.size(), idx.data, out.data(), idx.size);
+        return out;
+    }, "Gather: out[i] = values[indices[i]]", py::arg("values"), py::arg("indices"));
+    m.def("put", [](py::object target, py::object indices, py::object values) {
+        Vector dst = output_vector(target, "put", "target"), v = as_vector(values, "put");
+        Int64Arg idx(indices, "put");
+        if (idx.size != v.size()) throw py::value_error("put: indices and values must have the same length");
+        check_indices(idx.data, idx.size, dst.size());
+        put(dst.data(), dst.size(), idx.data, v.data(), idx.size);
+    }, "Scatter in place: target[indices[i]] = values[i]; for repeated indices the last value wins",
+       py::arg("target"), py::arg("indices"), py::arg("values"));
+    m.def("scatter_add", [](py::object target, py::object indices, py::object values) {
+        Vector dst = output_vector(target, "scatter_add", "target"), v = as_vector(values, "scatter_add");
+        Int64Arg idx(indices, "scatter_add");
+        if (idx.size != v.size()) throw py::value_error("scatter_add: indices and values must have the same length");
+        check_indices(idx.data, idx.size, dst.size());
+        scatter_add(dst.data(), dst.size(), idx.data, v.data(), idx.size);
+    }, "In place target[indices[i]] += values[i], accumulating repeated indices",
+       py::arg("target"), py::arg("indices"), py::arg("values"));
+
+    m.def("shuffle", &shuffle_values,
+          "Shuffle in place; the order depends only on seed, epoch and length, not on the thread count",
+          py::arg("values"), py::arg("seed"), py::arg("epoch") = 0);
+    m.def("permutation", [](size_t n, uint64_t seed, uint64_t epoch) {
+        py::object out = new_typed_buffer('q', n, sizeof(int64_t));
+        Span<int64_t> p(out.cast<py::buffer>(), "permutation", true);
+        random_permutation(p.data, n, seed, epoch);
+        return out;
+    }, "Random permutation of range(n) as an int64 memoryview, reproducible for a given seed and epoch",
+       py::arg("n"), py::arg("seed"), py::arg("epoch") = 0);
+
+    py::class_<Moments> moments(m, "Moments", "Mergeable count, mean, variance, skewness and kurtosis");
+    moments.def(py::init<>())
+        .def_property_readonly("count", locked_field(&Moments::n))
+        .def_property_readonly("mean", locked_field(&Moments::mean))
+        .def_property_readonly("min", locked_field(&Moments::min))
+        .def_property_readonly("max", locked_field(&Moments::max))
+        .def("variance", locked(&Moments::variance), "Variance with ddof delta degrees of freedom", py::arg("ddof") = 0)
+        .def_property_readonly("skewness", locked(&Moments::skewness))
+        .def_property_readonly("kurtosis", locked(&Moments::kurtosis), "Excess kurtosis");
+    def_sketch_updates<Moments>(moments, "Combine with the moments of another shard");
+    def_sketch_io<Moments>(moments);
+
+    py::class_<TDigest> digest(m, "TDigest", "Mergeable t-digest for approximate quantiles");
+    digest.def(py::init<double>(), py::arg("compression") = 100)
+        .def("quantile", locked(&TDigest::quantile), "Approximate value at quantile q in [0, 1]", py::arg("q"))
+        .def_property_readonly("count", locked(&TDigest::count))
+        .def_property_readonly("compression", &TDigest::compression)
+        .def("__len__", locked(&TDigest::size), "Number of centroids");
+    def_sketch_updates<TDigest>(digest, "Combine with the digest of another shard");
+    def_sketch_io<TDigest>(digest);
+
+    py::class_<HyperLogLog> hll(m, "HyperLogLog", "Mergeable approximate distinct count");
+    hll.def(py::init<int>(), py::arg("precision") = 14)
+        .def_property_readonly("count", locked(&HyperLogLog::count))
+        .def_property_readonly("precision", &HyperLogLog::precision);
+    def_sketch_updates<HyperLogLog>(hll, "Combine with the sketch of another shard");
+    def_sketch_io<HyperLogLog>(hll);
+
+    m.def("sketch", [](py::buffer values, double compression, int precision) {
+        Span<double> v(values, "sketch");
+        Sketches s = build_sketches(v.data, v.size, compression, precision);
+        return py::make_tuple(s.moments, s.digest, s.distinct);
+    }, "Build (Moments, TDigest, HyperLogLog) of a float64 buffer in one parallel pass",
+       py::arg("values"), py::arg("compression") = 100, py::arg("precision") = 14);
+
+    m.def("gemm", [](py::buffer a, py::buffer b, py::buffer c, double alpha, double beta, bool trans_a, bool trans_b) {
+        buffer_format(c) == 'f' ? gemm_buffer<float>(a, b, c, alpha, beta, trans_a, trans_b)
+                                : gemm_buffer<double>(a, b, c, alpha, beta, trans_a, trans_b);
+    }, "c = alpha * op(a) @ op(b) + beta * c on row-major float64/float32 matrices, in place",
+       py::arg("a"), py::arg("b"), py::arg("c"), py::arg("alpha") = 1.0, py::arg("beta") = 0.0,
+       py::arg("trans_a") = false, py::arg("trans_b") = false);
+    m.def("gemv", [](py::buffer a, py::buffer x, py::buffer y, double alpha, double beta, bool trans) {
+        buffer_format(y) == 'f' ? gemv_buffer<float>(a, x, y, alpha, beta, trans)
+                                : gemv_buffer<double>(a, x, y, alpha, beta, trans);
+    }, "y = alpha * op(a) @ x + beta * y on a row-major float64/float32 matrix, in place",
+       py::arg("a"), py::arg("x"), py::arg("y"), py::arg("alpha") = 1.0, py::arg("beta") = 0.0,
+       py::arg("trans") = false);
+
+    m.def("write_arrow", [](const std::string& path, py::object values, const std::string& name, size_t batch_size,
+                            bool stream) {
+        Vector v = as_vector(values, "write_arrow");
+        ArrowWriter writer(path, name, !stream);
+        size_t step = batch_size ? batch_size : std::max<size_t>(v.size(), 1);
+        for (size_t i = 0; i < v.size() || i == 0; i += step) writer.write_batch(v.slice(i, i + step));
+        writer.close();
+    }, "Write a float64 vector as one Arrow column (IPC file format, or stream format with stream=True)",
+       py::arg("path"), py::arg("values"), py::arg("name") = "values", py::arg("batch_size") = 0,
+       py::arg("stream") = false);
+    m.def("read_arrow", [](const std::string& path, py::object column) {
+        if (py::isinstance<py::str>(column)) return read_arrow(path, column.cast<std::string>(), 0);
+        return read_arrow(path, "", column.cast<size_t>());
+    }, "Map an Arrow IPC file or stream and return one read-only Vector per record batch of a float64 column",
+       py::arg("path"), py::arg("column") = 0);
+
+    m.def("compress", [](py::object values, const std::string& codec, size_t block_size) {
+        return py::bytes(compress(as_vector(values, "compress"), codec, block_size));
+    }, "Compress a float64 vector block by block (codec: auto, decimal, xor, shuffle or none)",
+       py::arg("values"), py::arg("codec") = "auto", py::arg("block_size") = 1 << 16);
+    m.def("decompress", &decompress_buffer,
+          "Decode elements [start, stop) of compressed bytes, decompressing only the blocks involved",
+          py::arg("data"), py::arg("start") = 0, py::arg("stop") = SIZE_MAX);
+    m.def("save", [](const std::string& path, py::object values, const std::string& codec, size_t block_size) {
+        std::string data = compress(as_vector(values, "save"), codec, block_size);
+        std::FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f) throw std::runtime_error("cannot open " + path + " for writing");
+        bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+        if (std::fclose(f) != 0 || !ok) throw std::runtime_error("failed to write " + path);
+    }, "Spill a float64 vector to a compressed file", py::arg("path"), py::arg("values"),
+       py::arg("codec") = "auto", py::arg("block_size") = 1 << 16);
+    m.def("load", [](const std::string& path, size_t start, size_t stop) {
+        MappedFile file(path);
+        return decompress(file.data, file.size, start, stop);
+    }, "Read elements [start, stop) back from a compressed file", py::arg("path"), py::arg("start") = 0,
+       py::arg("stop") = SIZE_MAX);
+
+    m.def("set_spill", [](size_t threshold, const std::string& directory) {
+        SpillConfig& config = spill_config();
+        {
+            std::lock_guard<std::mutex> guard(config.lock);
+            config.directory = directory;
+        }
+        config.threshold = threshold;
+    }, "Allocate vector results of at least threshold bytes from files in directory (0 disables; empty uses $TMPDIR)",
+       py::arg("threshold"), py::arg("directory") = "");
+    m.def("map_spill", [](const std::string& path, size_t offset, size_t length) {
+        return map_spill(path, offset, length);
+    }, "Read-only view of a spill file from Vector.spill_handle(); it shares pages with the owner and stays valid "
+       "after the owner deletes the file", py::arg("path"), py::arg("offset"), py::arg("length"));
+    m.def("spill_settings", []() {
+        py::dict d;
+        d["threshold"] = spill_config().threshold.load();
+        d["directory"] = spill_config().dir();
+        return d;
+    }, "Current spill threshold and scratch directory");
+    m.def("set_huge_pages", [](size_t threshold, bool hugetlb, bool prefault) {
+        HugePageConfig& config = huge_page_config();
+        config.threshold = threshold;
+        config.hugetlb = hugetlb;
+        config.prefault = prefault;
+    }, "Back vector results of at least threshold bytes with 2 MB pages (0 disables); hugetlb tries the "
+       "hugetlbfs pool first and prefault touches the pages in parallel at allocation",
+       py::arg("threshold"), py::arg("hugetlb") = false, py::arg("prefault") = false);
+    m.def("huge_page_settings", []() {
+        HugePageConfig& config = huge_page_config();
+        HugePageUsage usage = huge_page_usage();
+        py::dict d;
+        d["threshold"] = config.threshold.load();
+        d["hugetlb"] = config.hugetlb.load();
+        d["prefault"] = config.prefault.load();
+        d["allocations"] = config.allocations.load();
+        d["hugetlb_allocations"] = config.hugetlb_allocations.load();
+        d["hugetlb_fallbacks"] = config.hugetlb_fallbacks.load();
+        d["mapped_bytes"] = usage.mapped;
+        d["resident_bytes"] = usage.resident;
+        d["huge_bytes"] = usage.huge;
+        return d;
+    }, "Huge page settings, allocation counters, and how much of the live huge page vectors is "
+       "actually backed by huge pages (from /proc/self/smaps)");
+
+    m.def("vecsum", [](py::object values, bool reproducible) {
+        Vector v = as_vector(values, "vecsum");
+        return vector_sum(v.data(), v.size(), reproducible);
+    }, "Sum of a vector; reproducible=True gives the same bits for any thread count and instruction set",
+       py::arg("values"), py::arg("reproducible") = false);
+    m.def("vecdot", [](py::object a, py::object b, bool reproducible) {
+        Vector x = as_vector(a, "vecdot"), y = as_vector(b, "vecdot");
+        if (x.size() != y.size()) throw py::value_error("vecdot: inputs must have the same length");
+        return vector_dot(x.data(), y.data(), x.size(), reproducible);
+    }, "Dot product of two vectors; reproducible=True gives the same bits for any thread count and instruction set",
+       py::arg("a"), py::arg("b"), py::arg("reproducible") = false);
+
+    m.def("tuning", []() { return tuning_dict(tuned_params()); },
+          "Elementwise kernel settings for this host and where they came from (cache, calibrated, override, default)");
+    m.def("set_tuning", [](py::object threads, py::object grain, py::object parallel_threshold, py::object stream_min,
+                           bool persist) {
+        ElementwiseParams p = tuned_params();
+        if (!threads.is_none()) p.threads = threads.cast<size_t>();
+        if (!grain.is_none()) p.grain = std::max<size_t>(1, grain.cast<size_t>());
+        if (!parallel_threshold.is_none()) p.threshold = parallel_threshold.cast<size_t>();
+        if (!stream_min.is_none()) p.stream_min = stream_min.cast<size_t>();
+        override_params(p, persist);
+        return tuning_dict(p);
+    }, "Override tuned settings; persist=True also writes them to the per-host tuning cache",
+       py::arg("threads") = py::none(), py::arg("grain") = py::none(), py::arg("parallel_threshold") = py::none(),
+       py::arg("stream_min") = py::none(), py::arg("persist") = false);
+    m.def("retune", []() {
+        ElementwiseParams p;
+        {
+            py::gil_scoped_release release;
+            p = retune();
+        }
+        return tuning_dict(p);
+    }, "Run the calibration sweep and store its result in the per-host tuning cache; until then (or with no "
+       "cached profile) the built-in defaults are used");
+    m.def("set_workers", [](size_t threads) { worker_setting() = threads; },
+          "Thread count for the kernels outside the elementwise tuner (sort, segment, gather, reductions, gemm, "
+          "sketches); 0 means one per hardware thread", py::arg("threads"));
+    m.def("workers", &num_workers, "Thread count used by the kernels outside the elementwise tuner");
+
+    m.def("set_batching", [](bool enabled, double latency_us, size_t max_batch) {
+        if (latency_us < 0 || latency_us > 1e6 || max_batch < 1) {
+            throw py::value_error("latency_us must be between 0 and 1e6 and max_batch at least 1");
+        }
+        Batcher& b = batcher();
+        for (co_queue* q : {&b.add, &b.mul, &b.div}) co_configure(q, enabled, long(latency_us * 1000), max_batch);
+    }, "Coalesce concurrent small vecadd/vecmul/vecdiv calls on Vectors: each batch waits up to latency_us for "
+       "up to max_batch calls of one operation, then runs them as one parallel loop",
+       py::arg("enabled"), py::arg("latency_us") = 20.0, py::arg("max_batch") = 64);
+    m.def("batching", []() {
+        Batcher& b = batcher();
+        py::dict d;
+        for (auto& entry : {std::make_pair("vecadd", &b.add), std::make_pair("vecmul", &b.mul),
+                            std::make_pair("vecdiv", &b.div)}) {
+            co_queue snapshot;
+            co_snapshot(entry.second, &snapshot);
+            d["enabled"] = bool(snapshot.enabled);
+            d["latency_us"] = snapshot.latency_ns / 1000.0;
+            d["max_batch"] = snapshot.max_batch;
+            d[entry.first] = py::dict(py::arg("batches") = snapshot.batches, py::arg("requests") = snapshot.requests);
+        }
+        return d;
+    }, "Batching settings and, per operation, how many batches and calls went through it");
+
+    m.def("diagnostics", &diagnostics,
+          "Import time and which lazily started parts (worker pool, CPU probing, tuning) are running");
+    module_ready = tuning_now();
+    module_init_seconds = module_ready - init_start;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vector.h"
+
+// A read-only mapping of a whole file, shared by every Vector that points into it.
+struct MappedFile {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    std::string path;
+
+    explicit MappedFile(const std::string& path) : path(path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        size = size_t(st.st_size);
+        if (size) {
+            void* p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            data = static_cast<uint8_t*>(p);
+        }
+        ::close(fd);
+    }
+    ~MappedFile() {
+        if (data) ::munmap(data, size);
+    }
+};
+
+struct MappedStorage : Storage {
+    std::shared_ptr<MappedFile> file;
+    MappedStorage(std::shared_ptr<MappedFile> f, const uint8_t* at, size_t n) : file(std::move(f)) {
+        data = reinterpret_cast<double*>(const_cast<uint8_t*>(at));
+        size = n;
+        readonly = true;
+    }
+};
+
+// Map the elements [offset, offset + length) of a spill file handed over by another process on
+// the same node. The view is read-only and shares pages with the owner, so it sees the owner's
+// later writes.
+inline Vector map_spill(const std::string& path, size_t offset, size_t length) {
+    auto file = std::make_shared<MappedFile>(path);
+    size_t elements = file->size / sizeof(double);
+    if (offset > elements || length > elements - offset) throw std::runtime_error("spill file " + path + " is too short");
+    const uint8_t* at = file->data + offset * sizeof(double);
+    return Vector(std::make_shared<MappedStorage>(std::move(file), at, length), 0, length);
+}
+
+// Path of the file behind a vector's storage, or an empty string for memory-backed vectors.
+inline std::string backing_file(const Vector& v) {
+    if (auto spill = dynamic_cast<SpillStorage*>(v.storage().get())) return spill->path;
+    if (auto mapped = dynamic_cast<MappedStorage*>(v.storage().get())) return mapped->file->path;
+    return "";
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MASKED_X86 1
+#endif
+
+#include "kernels.h"
+#include "simd.h"
+
+// Which elements a masked operation touches: one byte per element (nonzero = set), or packed
+// words holding element i in bit i % 64 of word i / 64. Exactly one pointer is non-null.
+struct Mask {
+    const uint8_t* bytes;
+    const uint64_t* bits;
+};
+
+// Mask bits for the 8 elements starting at i (a multiple of 8), lowest bit first.
+inline unsigned mask8(const Mask& m, size_t i) {
+    if (m.bits) return unsigned(m.bits[i >> 6] >> (i & 63)) & 0xff;
+    uint64_t x;
+    std::memcpy(&x, m.bytes + i, 8);
+    // Set the high bit of every nonzero byte, then gather the high bits into the top byte.
+    x = (x | ((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL)) & 0x8080808080808080ULL;
+    return unsigned((x >> 7) * 0x0102040810204080ULL >> 56);
+}
+
+inline bool mask_at(const Mask& m, size_t i) {
+    return m.bits ? (m.bits[i >> 6] >> (i & 63)) & 1 : m.bytes[i] != 0;
+}
+
+// Operations for the masked kernels, written once for doubles and for the vector types. Results
+// go through a reference so no vector is passed by value across the target boundary.
+struct MaskedAdd {
+    template <typename T>
+    static void apply(const T& x, const T& y, T& z) { z = x + y; }
+};
+
+struct MaskedMul {
+    template <typename T>
+    static void apply(const T& x, const T& y, T& z) { z = x * y; }
+};
+
+struct MaskedDiv {
+    template <typename T>
+    static void apply(const T& x, const T& y, T& z) { z = x / y; }
+};
+
+// c[i] = a[i] op b[i] for set i in [begin, end); other elements of c are neither read nor written.
+// Elements go 8 at a time so each group's mask is one byte, used as a mask register, a blend
+// mask or a bit scan depending on the instruction set.
+template <typename Op>
+void masked_scalar(const double* a, const double* b, double* c, const Mask& m, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i < end && (i & 7); i++) {
+        if (mask_at(m, i)) Op::apply(a[i], b[i], c[i]);
+    }
+    for (; i + 8 <= end; i += 8) {
+        for (unsigned k = mask8(m, i); k; k &= k - 1) {
+            size_t j = i + __builtin_ctz(k);
+            Op::apply(a[j], b[j], c[j]);
+        }
+    }
+    for (; i < end; i++) {
+        if (mask_at(m, i)) Op::apply(a[i], b[i], c[i]);
+    }
+}
+
+#ifdef MASKED_X86
+// Masked-off lanes are not loaded, so padding past a mapping or a zero divisor never faults.
+template <typename Op>
+__attribute__((target("avx512f"))) void masked_avx512(const double* a, const double* b, double* c, const Mask& m,
+                                                      size_t begin, size_t end) {
+    typedef double vec __attribute__((vector_size(64)));
+    size_t i = begin;
+    for (; i < end && (i & 7); i++) {
+        if (mask_at(m, i)) Op::apply(a[i], b[i], c[i]);
+    }
+    for (; i + 8 <= end; i += 8) {
+        __mmask8 k = __mmask8(mask8(m, i));
+        if (!k) continue;
+        vec x = (vec) _mm512_maskz_loadu_pd(k, a + i), y = (vec) _mm512_mask_loadu_pd(_mm512_set1_pd(1.0), k, b + i), z;
+        Op::apply(x, y, z);
+        _mm512_mask_storeu_pd(c + i, k, (__m512d) z);
+    }
+    for (; i < end; i++) {
+        if (mask_at(m, i)) Op::apply(a[i], b[i], c[i]);
+    }
+}
+
+template <typename Op>
+__attribute__((target("avx2"))) void masked_avx2(const double* a, const double* b, double* c, const Mask& m,
+                                                 size_t begin, size_t end) {
+    typedef double vec __attribute__((vector_size(32)));
+    size_t i = begin;
+    for (; i < end && (i & 7); i++) {
+        if (mask_at(m, i)) Op::apply(a[i], b[i], c[i]);
+    }
+    for (; i + 8 <= end; i += 8) {
+        unsigned k8 = mask8(m, i);
+        for (unsigned half = 0; half < 8 && k8; half += 4) {
+            unsigned k = (k8 >> half) & 15;
+            if (!k) continue;
+            __m256i lanes = _mm256_set_epi64x(-int64_t(k >> 3 & 1), -int64_t(k >> 2 & 1), -int64_t(k >> 1 & 1),
+                                              -int64_t(k & 1));
+            vec x = (vec) _mm256_maskload_pd(a + i + half, lanes);
+            vec y = (vec) _mm256_blendv_pd(_mm256_set1_pd(1.0), _mm256_maskload_pd(b + i + half, lanes),
+                                           _mm256_castsi256_pd(lanes)), z;
+            Op::apply(x, y, z);
+            _mm256_maskstore_pd(c + i + half, lanes, (__m256d) z);
+        }
+    }
+    for (; i < end; i++) {
+        if (mask_at(m, i)) Op::apply(a[i], b[i], c[i]);
+    }
+}
+#endif
+
+typedef void (*masked_kernel)(const double*, const double*, double*, const Mask&, size_t, size_t);
+
+// Best masked kernel for this CPU, picked once.
+template <typename Op>
+masked_kernel select_masked() {
+#ifdef MASKED_X86
+    if (cpu_features().avx512f) return masked_avx512<Op>;
+    if (cpu_features().avx2) return masked_avx2<Op>;
+#endif
+    return masked_scalar<Op>;
+}
+
+template <typename Op>
+void masked_elementwise(const double* a, const double* b, double* c, const Mask& m, size_t n,
+                        const ElementwiseParams& p) {
+    static const masked_kernel kernel = select_masked<Op>();
+    if (n < p.threshold) {
+        kernel(a, b, c, m, 0, n);
+        return;
+    }
+    parallel_for(n, p.grain, [&](size_t, size_t begin, size_t end) { kernel(a, b, c, m, begin, end); }, p.threads);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "worksteal.h"
+
+inline size_t hardware_workers() {
+    static const size_t n = std::max(1u, std::thread::hardware_concurrency());
+    return n;
+}
+
+// Thread count chosen by the autotuner or the user; 0 means one per hardware thread.
+inline std::atomic<size_t>& worker_setting() {
+    static std::atomic<size_t> n{0};
+    return n;
+}
+
+// Number of threads the parallel kernels fan out to.
+inline size_t num_workers() {
+    size_t n = worker_setting().load(std::memory_order_relaxed);
+    return n ? n : hardware_workers();
+}
+
+// Run f(t) for every t in [0, tasks) on at most max_threads threads (num_workers() when 0) of
+// the shared work-stealing pool (common/worksteal.h). Each of the `threads` stripes claims the
+// next task from a shared counter, so uneven tasks balance out; calls made from inside a task
+// queue their stripes on the same pool, and the waiting task helps run them.
+template <typename F>
+void parallel_invoke(size_t tasks, F&& f, size_t max_threads = 0) {
+    size_t threads = std::min(tasks, max_threads ? max_threads : num_workers());
+    if (threads <= 1) {
+        for (size_t t = 0; t < tasks; t++) f(t);
+        return;
+    }
+    // The first exception thrown by any task is rethrown on the calling thread; the remaining
+    // tasks are skipped.
+    struct Loop {
+        F& f;
+        size_t tasks;
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex error_lock;
+
+        Loop(F& f, size_t tasks) : f(f), tasks(tasks) {}
+
+        static void stripe(void* ctx, size_t) {
+            Loop& loop = *static_cast<Loop*>(ctx);
+            try {
+                for (size_t t; !loop.failed.load(std::memory_order_relaxed) && (t = loop.next++) < loop.tasks;) loop.f(t);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(loop.error_lock);
+                if (!loop.error) loop.error = std::current_exception();
+                loop.failed = true;
+            }
+        }
+    } loop(f, tasks);
+    ws_parallel_for(threads, &Loop::stripe, &loop);
+    if (loop.error) std::rethrow_exception(loop.error);
+}
+
+// Number of chunks parallel_for splits n elements into.
+inline size_t parallel_chunks(size_t n, size_t grain, size_t max_threads = 0) {
+    size_t threads = max_threads ? max_threads : num_workers();
+    return std::max<size_t>(1, std::min(threads, (n + grain - 1) / grain));
+}
+
+// Split [0, n) into parallel_chunks(n, grain) contiguous ranges and run f(chunk, begin, end) on each.
+template <typename F>
+void parallel_for(size_t n, size_t grain, F&& f, size_t max_threads = 0) {
+    size_t chunks = parallel_chunks(n, grain, max_threads);
+    size_t step = (n + chunks - 1) / chunks;
+    parallel_invoke(chunks, [&](size_t c) {
+        size_t begin = std::min(n, c * step);
+        f(c, begin, std::min(n, begin + step));
+    }, max_threads);
+}
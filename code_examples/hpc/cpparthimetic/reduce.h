@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "parallel.h"
+#include "simd.h"
+
+// Sums over float64 data in two modes. The fast mode gives every worker one contiguous chunk, so
+// the rounding depends on the thread count. The reproducible mode always cuts the input into
+// the same fixed blocks, sums each block in eight interleaved lanes folded by a fixed tree, and
+// folds the block sums by a fixed pairwise tree. Only plain IEEE adds and multiplies are used
+// (no FMA contraction), so every SIMD clone and every thread count gives the same bits.
+
+const size_t reduce_block = 4096;
+const size_t reduce_lanes = 8;
+
+template <bool Dot>
+SIMD_CLONES double lane_sum(const double* x, const double* y, size_t n) {
+    double acc[reduce_lanes] = {};
+    size_t body = n - n % reduce_lanes;
+    for (size_t i = 0; i < body; i += reduce_lanes) {
+        for (size_t j = 0; j < reduce_lanes; j++) acc[j] += Dot ? x[i + j] * y[i + j] : x[i + j];
+    }
+    for (size_t i = body; i < n; i++) acc[i - body] += Dot ? x[i] * y[i] : x[i];
+    for (size_t width = reduce_lanes / 2; width > 0; width /= 2) {
+        for (size_t j = 0; j < width; j++) acc[j] += acc[j + width];
+    }
+    return acc[0];
+}
+
+inline double tree_sum(const double* v, size_t n) {
+    if (n == 0) return 0.0;
+    if (n == 1) return v[0];
+    size_t half = n / 2;
+    return tree_sum(v, half) + tree_sum(v + half, n - half);
+}
+
+template <bool Dot>
+double reduce(const double* x, const double* y, size_t n, bool reproducible) {
+    if (!reproducible) {
+        size_t threads = num_workers();
+        std::vector<double> partial(parallel_chunks(n, 1 << 16, threads));
+        parallel_for(n, 1 << 16, [&](size_t c, size_t begin, size_t end) {
+            partial[c] = lane_sum<Dot>(x + begin, Dot ? y + begin : nullptr, end - begin);
+        }, threads);
+        double s = 0;
+        for (double p : partial) s += p;
+        return s;
+    }
+    size_t blocks = (n + reduce_block - 1) / reduce_block;
+    std::vector<double> sums(blocks);
+    parallel_for(blocks, 16, [&](size_t, size_t begin, size_t end) {
+        for (size_t b = begin; b < end; b++) {
+            size_t i = b * reduce_block;
+            sums[b] = lane_sum<Dot>(x + i, Dot ? y + i : nullptr, std::min(reduce_block, n - i));
+        }
+    });
+    return tree_sum(sums.data(), blocks);
+}
+
+inline double vector_sum(const double* x, size_t n, bool reproducible) {
+    return reduce<false>(x, nullptr, n, reproducible);
+}
+
+inline double vector_dot(const double* x, const double* y, size_t n, bool reproducible) {
+    return reduce<true>(x, y, n, reproducible);
+}
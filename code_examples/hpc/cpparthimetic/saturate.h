@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SATURATE_X86 1
+#endif
+
+#include "kernels.h"
+#include "simd.h"
+
+// Saturating integer and Q15 fixed-point arithmetic on int8, uint8, int16 and uint16 data.
+// Results that do not fit are clamped to the type's range instead of wrapping. Each op has a
+// scalar form and 16/32-byte forms built on the packed saturating instructions (padds*, psubs*,
+// pmulhrsw, packs*), so one instruction covers 8-32 elements.
+
+template <typename T>
+T saturate(int64_t v) {
+    return T(std::min<int64_t>(std::numeric_limits<T>::max(), std::max<int64_t>(std::numeric_limits<T>::min(), v)));
+}
+
+template <typename T>
+constexpr bool is_int8() { return std::is_same<T, int8_t>::value; }
+template <typename T>
+constexpr bool is_uint8() { return std::is_same<T, uint8_t>::value; }
+template <typename T>
+constexpr bool is_int16() { return std::is_same<T, int16_t>::value; }
+
+struct SatAdd {
+    template <typename T>
+    static T scalar(T x, T y) { return saturate<T>(int32_t(x) + int32_t(y)); }
+#ifdef SATURATE_X86
+    template <typename T>
+    __attribute__((target("ssse3"))) static __m128i sse(__m128i x, __m128i y) {
+        if constexpr (is_int8<T>()) return _mm_adds_epi8(x, y);
+        else if constexpr (is_uint8<T>()) return _mm_adds_epu8(x, y);
+        else if constexpr (is_int16<T>()) return _mm_adds_epi16(x, y);
+        else return _mm_adds_epu16(x, y);
+    }
+    template <typename T>
+    __attribute__((target("avx2"))) static __m256i avx(__m256i x, __m256i y) {
+        if constexpr (is_int8<T>()) return _mm256_adds_epi8(x, y);
+        else if constexpr (is_uint8<T>()) return _mm256_adds_epu8(x, y);
+        else if constexpr (is_int16<T>()) return _mm256_adds_epi16(x, y);
+        else return _mm256_adds_epu16(x, y);
+    }
+#endif
+};
+
+struct SatSub {
+    template <typename T>
+    static T scalar(T x, T y) { return saturate<T>(int32_t(x) - int32_t(y)); }
+#ifdef SATURATE_X86
+    template <typename T>
+    __attribute__((target("ssse3"))) static __m128i sse(__m128i x, __m128i y) {
+        if constexpr (is_int8<T>()) return _mm_subs_epi8(x, y);
+        else if constexpr (is_uint8<T>()) return _mm_subs_epu8(x, y);
+        else if constexpr (is_int16<T>()) return _mm_subs_epi16(x, y);
+        else return _mm_subs_epu16(x, y);
+    }
+    template <typename T>
+    __attribute__((target("avx2"))) static __m256i avx(__m256i x, __m256i y) {
+        if constexpr (is_int8<T>()) return _mm256_subs_epi8(x, y);
+        else if constexpr (is_uint8<T>()) return _mm256_subs_epu8(x, y);
+        else if constexpr (is_int16<T>()) return _mm256_subs_epi16(x, y);
+        else return _mm256_subs_epu16(x, y);
+    }
+#endif
+};
+
+// There is no saturating packed multiply: 8-bit lanes are widened to 16 bits and packed back
+// with saturation, 16-bit lanes combine the low and high product halves.
+struct SatMul {
+    template <typename T>
+    static T scalar(T x, T y) { return saturate<T>(int64_t(x) * int64_t(y)); }
+#ifdef SATURATE_X86
+    template <typename T>
+    __attribute__((target("ssse3"))) static __m128i sse(__m128i x, __m128i y) {
+        if constexpr (is_int8<T>()) {
+            __m128i lo = _mm_mullo_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8), _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8));
+            __m128i hi = _mm_mullo_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8), _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8));
+            return _mm_packs_epi16(lo, hi);
+        } else if constexpr (is_uint8<T>()) {
+            __m128i zero = _mm_setzero_si128(), top = _mm_set1_epi16(255);
+            __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero));
+            __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero));
+            // Products above 255 have a nonzero high byte; clamp them before the signed pack.
+            __m128i lo_ok = _mm_cmpeq_epi16(_mm_srli_epi16(lo, 8), zero), hi_ok = _mm_cmpeq_epi16(_mm_srli_epi16(hi, 8), zero);
+            lo = _mm_or_si128(_mm_and_si128(lo, lo_ok), _mm_andnot_si128(lo_ok, top));
+            hi = _mm_or_si128(_mm_and_si128(hi, hi_ok), _mm_andnot_si128(hi_ok, top));
+            return _mm_packus_epi16(lo, hi);
+        } else if constexpr (is_int16<T>()) {
+            __m128i lo = _mm_mullo_epi16(x, y), hi = _mm_mulhi_epi16(x, y);
+            return _mm_packs_epi32(_mm_unpacklo_epi16(lo, hi), _mm_unpackhi_epi16(lo, hi));
+        } else {
+            __m128i hi = _mm_mulhi_epu16(x, y);
+            __m128i overflow = _mm_xor_si128(_mm_cmpeq_epi16(hi, _mm_setzero_si128()), _mm_set1_epi16(-1));
+            return _mm_or_si128(_mm_mullo_epi16(x, y), overflow);
+        }
+    }
+    template <typename T>
+    __attribute__((target("avx2"))) static __m256i avx(__m256i x, __m256i y) {
+        // The unpacks and packs work within 128-bit lanes, so element order survives the round trip.
+        if constexpr (is_int8<T>()) {
+            __m256i lo = _mm256_mullo_epi16(_mm256_srai_epi16(_mm256_unpacklo_epi8(x, x), 8),
+                                            _mm256_srai_epi16(_mm256_unpacklo_epi8(y, y), 8));
+            __m256i hi = _mm256_mullo_epi16(_mm256_srai_epi16(_mm256_unpackhi_epi8(x, x), 8),
+                                            _mm256_srai_epi16(_mm256_unpackhi_epi8(y, y), 8));
+            return _mm256_packs_epi16(lo, hi);
+        } else if constexpr (is_uint8<T>()) {
+            __m256i zero = _mm256_setzero_si256();
+            __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(x, zero), _mm256_unpacklo_epi8(y, zero));
+            __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(x, zero), _mm256_unpackhi_epi8(y, zero));
+            __m256i top = _mm256_set1_epi16(255);
+            return _mm256_packus_epi16(_mm256_min_epu16(lo, top), _mm256_min_epu16(hi, top));
+        } else if constexpr (is_int16<T>()) {
+            __m256i lo = _mm256_mullo_epi16(x, y), hi = _mm256_mulhi_epi16(x, y);
+            return _mm256_packs_epi32(_mm256_unpacklo_epi16(lo, hi), _mm256_unpackhi_epi16(lo, hi));
+        } else {
+            __m256i hi = _mm256_mulhi_epu16(x, y);
+            __m256i overflow = _mm256_xor_si256(_mm256_cmpeq_epi16(hi, _mm256_setzero_si256()), _mm256_set1_epi16(-1));
+            return _mm256_or_si256(_mm256_mullo_epi16(x, y), overflow);
+        }
+    }
+#endif
+};
+
+// Q15 multiply with rounding: (x * y + 2^14) >> 15 on int16. pmulhrsw computes exactly this but
+// wraps -1 * -1 (-32768 * -32768) to -32768, the only product that can produce 0x8000; it is
+// flipped to 32767.
+struct Q15Mul {
+    template <typename T>
+    static T scalar(T x, T y) { return saturate<T>((int32_t(x) * int32_t(y) + (1 << 14)) >> 15); }
+#ifdef SATURATE_X86
+    template <typename T>
+    __attribute__((target("ssse3"))) static __m128i sse(__m128i x, __m128i y) {
+        __m128i r = _mm_mulhrs_epi16(x, y);
+        return _mm_xor_si128(r, _mm_cmpeq_epi16(r, _mm_set1_epi16(-32768)));
+    }
+    template <typename T>
+    __attribute__((target("avx2"))) static __m256i avx(__m256i x, __m256i y) {
+        __m256i r = _mm256_mulhrs_epi16(x, y);
+        return _mm256_xor_si256(r, _mm256_cmpeq_epi16(r, _mm256_set1_epi16(-32768)));
+    }
+#endif
+};
+
+template <typename T, typename Op>
+void saturating_scalar(const T* a, const T* b, T* c, size_t n) {
+    for (size_t i = 0; i < n; i++) c[i] = Op::template scalar<T>(a[i], b[i]);
+}
+
+#ifdef SATURATE_X86
+template <typename T, typename Op>
+__attribute__((target("ssse3"))) void saturating_sse(const T* a, const T* b, T* c, size_t n) {
+    const size_t lanes = 16 / sizeof(T);
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c + i), Op::template sse<T>(x, y));
+    }
+    saturating_scalar<T, Op>(a + i, b + i, c + i, n - i);
+}
+
+template <typename T, typename Op>
+__attribute__((target("avx2"))) void saturating_avx2(const T* a, const T* b, T* c, size_t n) {
+    const size_t lanes = 32 / sizeof(T);
+    size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + i), Op::template avx<T>(x, y));
+    }
+    saturating_scalar<T, Op>(a + i, b + i, c + i, n - i);
+}
+#endif
+
+// Best kernel for this CPU, picked once per type and op.
+template <typename T, typename Op>
+void (*select_saturating())(const T*, const T*, T*, size_t) {
+#ifdef SATURATE_X86
+    if (cpu_features().avx2) return saturating_avx2<T, Op>;
+    if (cpu_features().ssse3) return saturating_sse<T, Op>;
+#endif
+    return saturating_scalar<T, Op>;
+}
+
+template <typename T, typename Op>
+void saturating(const T* a, const T* b, T* c, size_t n, const ElementwiseParams& p) {
+    static void (*const kernel)(const T*, const T*, T*, size_t) = select_saturating<T, Op>();
+    // The tuned sizes count doubles; keep the same number of bytes per chunk.
+    size_t scale = sizeof(double) / sizeof(T);
+    if (n / scale < p.threshold) {
+        kernel(a, b, c, n);
+        return;
+    }
+    parallel_for(n, p.grain * scale, [&](size_t, size_t begin, size_t end) {
+        kernel(a + begin, b + begin, c + begin, end - begin);
+    }, p.threads);
+}
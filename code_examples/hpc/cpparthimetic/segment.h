@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "parallel.h"
+#include "reduce.h"
+#include "simd.h"
+
+// Reductions and scans over variable-length segments of one vector. Segments are given as CSR
+// offsets: segment s is [offsets[s], offsets[s + 1]), offsets[0] == 0 and offsets[segments] == n.
+// Work is split by element count rather than by segment, so one huge segment next to millions of
+// tiny ones still spreads evenly; segments cut by a chunk boundary are combined afterwards.
+
+enum class SegmentOp { sum, min, max, mean };
+
+const size_t segment_grain = 1 << 15;
+
+SIMD_CLONES inline double min_of(const double* x, size_t n) {
+    double m = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; i++) m = x[i] < m ? x[i] : m;
+    return m;
+}
+
+SIMD_CLONES inline double max_of(const double* x, size_t n) {
+    double m = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < n; i++) m = x[i] > m ? x[i] : m;
+    return m;
+}
+
+inline double segment_identity(SegmentOp op) {
+    if (op == SegmentOp::min) return std::numeric_limits<double>::infinity();
+    if (op == SegmentOp::max) return -std::numeric_limits<double>::infinity();
+    return 0.0;
+}
+
+inline double segment_combine(SegmentOp op, double a, double b) {
+    if (op == SegmentOp::min) return b < a ? b : a;
+    if (op == SegmentOp::max) return b > a ? b : a;
+    return a + b;
+}
+
+inline double segment_partial(SegmentOp op, const double* x, size_t n) {
+    if (op == SegmentOp::min) return min_of(x, n);
+    if (op == SegmentOp::max) return max_of(x, n);
+    return lane_sum<false>(x, nullptr, n);
+}
+
+inline void check_offsets(const int64_t* offsets, size_t segments, size_t n) {
+    if (offsets[0] != 0 || offsets[segments] != int64_t(n)) {
+        throw std::invalid_argument("segment offsets must start at 0 and end at the vector length");
+    }
+    for (size_t s = 0; s < segments; s++) {
+        if (offsets[s + 1] < offsets[s]) throw std::invalid_argument("segment offsets must be non-decreasing");
+    }
+}
+
+// Segment containing element i (the last one, when empty segments share its start).
+inline size_t segment_of(const int64_t* offsets, size_t segments, size_t i) {
+    return size_t(std::upper_bound(offsets, offsets + segments + 1, int64_t(i)) - offsets) - 1;
+}
+
+// out[s] = op over segment s. Empty segments give 0 (sum), +inf (min), -inf (max) or NaN (mean).
+inline void segmented_reduce(const double* x, size_t n, const int64_t* offsets, size_t segments, double* out,
+                             SegmentOp op) {
+    check_offsets(offsets, segments, n);
+    SegmentOp base = op == SegmentOp::mean ? SegmentOp::sum : op;
+    std::fill(out, out + segments, segment_identity(base));
+
+    struct Partial {
+        size_t segment;
+        double value;
+    };
+    size_t threads = num_workers(), chunks = parallel_chunks(n, segment_grain, threads);
+    std::vector<std::vector<Partial>> partials(chunks);
+    parallel_for(n, segment_grain, [&](size_t c, size_t begin, size_t end) {
+        if (begin == end) return;
+        for (size_t s = segment_of(offsets, segments, begin); s < segments && size_t(offsets[s]) < end; s++) {
+            size_t lo = std::max<size_t>(offsets[s], begin), hi = std::min<size_t>(offsets[s + 1], end);
+            if (lo >= hi) continue;
+            double value = segment_partial(base, x + lo, hi - lo);
+            if (size_t(offsets[s]) >= begin && size_t(offsets[s + 1]) <= end) {
+                out[s] = value;
+            } else {
+                partials[c].push_back({s, value});
+            }
+        }
+    }, threads);
+    // Segments cut by chunk boundaries, combined in chunk order so results do not vary run to run.
+    for (const std::vector<Partial>& chunk : partials) {
+        for (const Partial& p : chunk) out[p.segment] = segment_combine(base, out[p.segment], p.value);
+    }
+    if (op == SegmentOp::mean) {
+        for (size_t s = 0; s < segments; s++) out[s] /= double(offsets[s + 1] - offsets[s]);
+    }
+}
+
+// Inclusive scan restarting at every segment: out[i] = op over x[offsets[s]..i]. Each chunk scans
+// locally, the carries into each chunk are chained serially, then chunks fix up their leading run.
+inline void segmented_scan(const double* x, size_t n, const int64_t* offsets, size_t segments, double* out,
+                           SegmentOp op) {
+    if (op == SegmentOp::mean) throw std::invalid_argument("segmented scans support sum, min and max");
+    check_offsets(offsets, segments, n);
+    size_t threads = num_workers(), chunks = parallel_chunks(n, segment_grain, threads);
+    std::vector<double> carry_out(chunks, segment_identity(op));
+    std::vector<size_t> lead_end(chunks);  // first segment start inside the chunk, or its end
+    parallel_for(n, segment_grain, [&](size_t c, size_t begin, size_t end) {
+        lead_end[c] = end;
+        if (begin == end) return;
+        size_t s = segment_of(offsets, segments, begin);
+        size_t next = size_t(offsets[s + 1]);
+        // A segment starting right at begin leaves no leading run to fix up.
+        lead_end[c] = size_t(offsets[s]) == begin ? begin : std::min(next, end);
+        double acc = segment_identity(op);
+        for (size_t i = begin; i < end; i++) {
+            while (i == next) {
+                acc = segment_identity(op);
+                s++;
+                next = size_t(offsets[s + 1]);
+            }
+            acc = segment_combine(op, acc, x[i]);
+            out[i] = acc;
+        }
+        carry_out[c] = acc;
+    }, threads);
+    std::vector<double> carry_in(chunks, segment_identity(op));
+    size_t step = chunks ? (n + chunks - 1) / chunks : 0;
+    for (size_t c = 1; c < chunks; c++) {
+        size_t prev_begin = std::min(n, (c - 1) * step), prev_end = std::min(n, prev_begin + step);
+        bool restarted = lead_end[c - 1] < prev_end;
+        carry_in[c] = restarted ? carry_out[c - 1] : segment_combine(op, carry_in[c - 1], carry_out[c - 1]);
+    }
+    parallel_for(n, segment_grain, [&](size_t c, size_t begin, size_t) {
+        if (c == 0) return;
+        for (size_t i = begin; i < lead_end[c]; i++) out[i] = segment_combine(op, carry_in[c], out[i]);
+    }, threads);
+}
+
+// CSR offsets of the runs of equal consecutive keys; run r is keyed by keys[offsets[r]].
+inline std::vector<int64_t> key_offsets(const int64_t* keys, size_t n) {
+    size_t threads = num_workers(), chunks = parallel_chunks(n, segment_grain, threads);
+    std::vector<size_t> counts(chunks + 1, 0);
+    parallel_for(n, segment_grain, [&](size_t c, size_t begin, size_t end) {
+        size_t count = 0;
+        for (size_t i = std::max<size_t>(begin, 1); i < end; i++) count += keys[i] != keys[i - 1];
+        counts[c + 1] = count;
+    }, threads);
+    for (size_t c = 0; c < chunks; c++) counts[c + 1] += counts[c];
+    size_t runs = n ? counts[chunks] + 1 : 0;
+    std::vector<int64_t> offsets(runs + 1);
+    offsets[0] = 0;
+    offsets[runs] = int64_t(n);
+    parallel_for(n, segment_grain, [&](size_t c, size_t begin, size_t end) {
+        size_t r = counts[c] + 1;
+        for (size_t i = std::max<size_t>(begin, 1); i < end; i++) {
+            if (keys[i] != keys[i - 1]) offsets[r++] = int64_t(i);
+        }
+    }, threads);
+    return offsets;
+}
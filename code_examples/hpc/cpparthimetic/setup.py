@@ -1,7 +1,8 @@
 from setuptools import setup
 from pybind11.setup_helpers import Pybind11Extension, build_ext
 
-cpparthimetic_module = Pybind11Extension('cpparthimetic', sources=['main.cc'])
+cpparthimetic_module = Pybind11Extension('cpparthimetic', sources=['main.cc'], cxx_std=17, include_dirs=['../common'],
+    extra_compile_args=['-ffp-contract=off', '-fno-math-errno'])
 
 setup(name = 'cpparthimetic',
     version='0.1.0',
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+// Parallel in-place shuffle (MergeShuffle: shuffle fixed blocks independently, then merge
+// neighbours with random bits level by level) driven by Philox4x32-10, a counter-based RNG.
+// Every block and every merge draws from its own stream, named by (seed, epoch, level, index),
+// so the permutation depends only on seed, epoch and length, never on the thread count. The
+// counter holds the draw number and the (level, index) stream; seed and epoch, 128 bits between
+// them, are folded into the 64-bit key.
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+struct Philox {
+    uint32_t key[2];
+    uint32_t ctr[4];
+    uint32_t out[4];
+    unsigned used = 4;
+
+    // The key is the first block of the epoch's counter (epoch, all ones) under the seed, so every
+    // bit of the epoch counts; two (seed, epoch) pairs share a key only by a 2^-64 chance. No
+    // stream reaches the all-ones counter words, so this block is never drawn.
+    Philox(uint64_t seed, uint64_t epoch, uint64_t stream) {
+        key[0] = uint32_t(seed);
+        key[1] = uint32_t(seed >> 32);
+        ctr[0] = uint32_t(epoch);
+        ctr[1] = uint32_t(epoch >> 32);
+        ctr[2] = ctr[3] = UINT32_MAX;
+        refill();
+        key[0] = out[0];
+        key[1] = out[1];
+        ctr[0] = ctr[1] = 0;
+        ctr[2] = uint32_t(stream);
+        ctr[3] = uint32_t(stream >> 32);
+        used = 4;
+    }
+
+    void refill() {
+        uint32_t c[4] = {ctr[0], ctr[1], ctr[2], ctr[3]}, k[2] = {key[0], key[1]};
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = uint64_t(0xD2511F53) * c[0], p1 = uint64_t(0xCD9E8D57) * c[2];
+            uint32_t next[4] = {uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1), uint32_t(p0 >> 32) ^ c[3] ^ k[1], uint32_t(p0)};
+            c[0] = next[0];
+            c[1] = next[1];
+            c[2] = next[2];
+            c[3] = next[3];
+            k[0] += 0x9E3779B9;
+            k[1] += 0xBB67AE85;
+        }
+        for (int i = 0; i < 4; i++) out[i] = c[i];
+        if (++ctr[0] == 0) ctr[1]++;
+        used = 0;
+    }
+
+    uint32_t next() {
+        if (used == 4) refill();
+        return out[used++];
+    }
+
+    // The operands of | are unsequenced, so the high word is drawn first into a local.
+    uint64_t next64() {
+        uint64_t hi = next();
+        return hi << 32 | next();
+    }
+
+    // Uniform in [0, range) without modulo bias (Lemire's multiply-shift with rejection).
+    uint64_t below(uint64_t range) {
+        if (range <= UINT32_MAX) {
+            uint64_t m = uint64_t(next()) * range;
+            if (uint32_t(m) < range) {
+                uint32_t threshold = uint32_t(-uint32_t(range)) % uint32_t(range);
+                while (uint32_t(m) < threshold) m = uint64_t(next()) * range;
+            }
+            return m >> 32;
+        }
+        unsigned __int128 m = (unsigned __int128) next64() * range;
+        if (uint64_t(m) < range) {
+            uint64_t threshold = -range % range;
+            while (uint64_t(m) < threshold) m = (unsigned __int128) next64() * range;
+        }
+        return uint64_t(m >> 64);
+    }
+};
+
+// Elements per independently shuffled block. Fixed, so the output does not depend on threads.
+const size_t shuffle_block = 1 << 16;
+
+// Levels stay below 64 and indices below 2^58, so streams are distinct and never all ones.
+inline uint64_t shuffle_stream(uint64_t level, uint64_t index) {
+    return level << 58 | index;
+}
+
+template <typename T>
+void fisher_yates(T* v, size_t n, Philox& rng) {
+    for (size_t i = n; i > 1; i--) std::swap(v[i - 1], v[rng.below(i)]);
+}
+
+// Merge two shuffled neighbours [0, m) and [m, n) into a shuffled [0, n): random bits pick which
+// side supplies each position until one side runs out, then the rest are inserted Fisher-Yates
+// style (Bacher, Bodini, Hollender, Lumbroso: "MergeShuffle").
+template <typename T>
+void merge_shuffled(T* v, size_t m, size_t n, Philox& rng) {
+    size_t i = 0, j = m;
+    uint32_t bits = 0;
+    unsigned left = 0;
+    while (true) {
+        if (left == 0) {
+            bits = rng.next();
+            left = 32;
+        }
+        bool flip = bits & 1;
+        bits >>= 1;
+        left--;
+        if (flip) {
+            if (j == n) break;
+            std::swap(v[i], v[j++]);
+        } else if (i == j) {
+            break;
+        }
+        i++;
+    }
+    for (; i < n; i++) std::swap(v[rng.below(i + 1)], v[i]);
+}
+
+template <typename T>
+void parallel_shuffle(T* v, size_t n, uint64_t seed, uint64_t epoch) {
+    size_t blocks = (n + shuffle_block - 1) / shuffle_block;
+    parallel_invoke(blocks, [&](size_t b) {
+        Philox rng(seed, epoch, shuffle_stream(0, b));
+        size_t begin = b * shuffle_block;
+        fisher_yates(v + begin, std::min(shuffle_block, n - begin), rng);
+    });
+    size_t level = 1;
+    for (size_t width = shuffle_block; width < n; width *= 2, level++) {
+        size_t pairs = (n + 2 * width - 1) / (2 * width);
+        parallel_invoke(pairs, [&](size_t p) {
+            size_t begin = p * 2 * width;
+            if (begin + width >= n) return;  // odd block out: nothing to merge with
+            Philox rng(seed, epoch, shuffle_stream(level, p));
+            merge_shuffled(v + begin, width, std::min(2 * width, n - begin), rng);
+        });
+    }
+}
+
+// A random permutation of 0 .. n-1.
+inline void random_permutation(int64_t* out, size_t n, uint64_t seed, uint64_t epoch) {
+    parallel_for(n, shuffle_block, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) out[i] = int64_t(i);
+    });
+    parallel_shuffle(out, n, seed, epoch);
+}
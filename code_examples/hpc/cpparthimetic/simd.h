@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+
+// Compile a kernel once per instruction set and pick the best clone at load time, so the
+// auto-vectorized loops use AVX-512/AVX2 where the CPU has them without -march flags.
+// SIMD_CLONES_FMA additionally lets the compiler fuse multiply-adds; results may then
+// differ in the last bit between clones, so reductions that must be reproducible avoid it.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__linux__)
+#define SIMD_CLONES __attribute__((target_clones("arch=skylake-avx512", "arch=haswell", "default")))
+#define SIMD_CLONES_FMA \
+    __attribute__((target_clones("arch=skylake-avx512", "arch=haswell", "default"), optimize("fp-contract=fast")))
+#else
+#define SIMD_CLONES
+#define SIMD_CLONES_FMA
+#endif
+
+// CPU features for the hand-written intrinsic kernels, probed on the first kernel call that
+// needs them rather than at import.
+struct CpuFeatures {
+    bool ssse3 = false, avx2 = false, avx512f = false;
+};
+
+inline std::atomic<bool>& cpu_probed() {
+    static std::atomic<bool> probed{false};
+    return probed;
+}
+
+inline const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = [] {
+        CpuFeatures f;
+#if defined(__x86_64__) && defined(__GNUC__)
+        __builtin_cpu_init();
+        f.ssse3 = __builtin_cpu_supports("ssse3");
+        f.avx2 = __builtin_cpu_supports("avx2");
+        f.avx512f = __builtin_cpu_supports("avx512f");
+#endif
+        cpu_probed() = true;
+        return f;
+    }();
+    return features;
+}
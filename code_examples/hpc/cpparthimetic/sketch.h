@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+#include "simd.h"
+
+// Little-endian byte (de)serialization shared by the sketches.
+struct ByteWriter {
+    std::string out;
+    template <typename T>
+    void put(T v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+};
+
+struct ByteReader {
+    const std::string& in;
+    size_t pos = 0;
+    explicit ByteReader(const std::string& s) : in(s) {}
+    template <typename T>
+    T get() {
+        if (pos + sizeof(T) > in.size()) throw std::invalid_argument("truncated sketch");
+        T v;
+        std::memcpy(&v, in.data() + pos, sizeof(v));
+        pos += sizeof(v);
+        return v;
+    }
+    void expect(uint8_t tag) {
+        if (get<uint8_t>() != tag) throw std::invalid_argument("not a serialized sketch of this type");
+    }
+};
+
+// Count, mean and central moments up to the fourth order. Blocks are summarized with a
+// vectorized two-pass over cache-resident data and combined with Chan/Pebay updates.
+struct Moments {
+    double n = 0, mean = 0, m2 = 0, m3 = 0, m4 = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void merge(const Moments& o) {
+        if (o.n == 0) return;
+        if (n == 0) { *this = o; return; }
+        double na = n, nb = o.n, nt = na + nb;
+        double d = o.mean - mean, d2 = d * d;
+        double m4n = m4 + o.m4 + d2 * d2 * na * nb * (na * na - na * nb + nb * nb) / (nt * nt * nt)
+                     + 6 * d2 * (na * na * o.m2 + nb * nb * m2) / (nt * nt) + 4 * d * (na * o.m3 - nb * m3) / nt;
+        double m3n = m3 + o.m3 + d2 * d * na * nb * (na - nb) / (nt * nt) + 3 * d * (na * o.m2 - nb * m2) / nt;
+        m2 = m2 + o.m2 + d2 * na * nb / nt;
+        m3 = m3n;
+        m4 = m4n;
+        mean += d * nb / nt;
+        n = nt;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+    }
+
+    void update(const double* x, size_t len) {
+        const size_t block = 2048;
+        for (size_t i = 0; i < len; i += block) merge(summarize(x + i, std::min(block, len - i)));
+    }
+
+    double variance(double ddof = 0) const { return n > ddof ? m2 / (n - ddof) : std::nan(""); }
+    double skewness() const { return std::sqrt(n) * m3 / std::pow(m2, 1.5); }
+    double kurtosis() const { return n * m4 / (m2 * m2) - 3; }
+
+    std::string serialize() const {
+        ByteWriter w;
+        w.put<uint8_t>('M');
+        for (double v : {n, mean, m2, m3, m4, min, max}) w.put(v);
+        return w.out;
+    }
+
+    static Moments deserialize(const std::string& s) {
+        ByteReader r(s);
+        r.expect('M');
+        Moments m;
+        for (double* v : {&m.n, &m.mean, &m.m2, &m.m3, &m.m4, &m.min, &m.max}) *v = r.get<double>();
+        return m;
+    }
+
+    // Eight independent accumulator lanes keep the reductions vectorizable without reassociation.
+    SIMD_CLONES static Moments summarize(const double* x, size_t len) {
+        const size_t lanes = 8;
+        Moments m;
+        double sum[lanes] = {}, lo[lanes], hi[lanes];
+        std::fill(lo, lo + lanes, m.min);
+        std::fill(hi, hi + lanes, m.max);
+        size_t body = len - len % lanes;
+        for (size_t i = 0; i < body; i += lanes) {
+            for (size_t j = 0; j < lanes; j++) {
+                sum[j] += x[i + j];
+                lo[j] = x[i + j] < lo[j] ? x[i + j] : lo[j];
+                hi[j] = x[i + j] > hi[j] ? x[i + j] : hi[j];
+            }
+        }
+        for (size_t i = body; i < len; i++) {
+            sum[0] += x[i];
+            lo[0] = std::min(lo[0], x[i]);
+            hi[0] = std::max(hi[0], x[i]);
+        }
+        double total = 0;
+        for (size_t j = 0; j < lanes; j++) {
+            total += sum[j];
+            m.min = std::min(m.min, lo[j]);
+            m.max = std::max(m.max, hi[j]);
+        }
+
+        double mean = total / len, s2[lanes] = {}, s3[lanes] = {}, s4[lanes] = {};
+        for (size_t i = 0; i < body; i += lanes) {
+            for (size_t j = 0; j < lanes; j++) {
+                double d = x[i + j] - mean, d2 = d * d;
+                s2[j] += d2;
+                s3[j] += d2 * d;
+                s4[j] += d2 * d2;
+            }
+        }
+        for (size_t i = body; i < len; i++) {
+            double d = x[i] - mean, d2 = d * d;
+            s2[0] += d2;
+            s3[0] += d2 * d;
+            s4[0] += d2 * d2;
+        }
+        m.n = double(len);
+        m.mean = mean;
+        for (size_t j = 0; j < lanes; j++) {
+            m.m2 += s2[j];
+            m.m3 += s3[j];
+            m.m4 += s4[j];
+        }
+        return m;
+    }
+};
+
+// Merging t-digest (Dunning) with the arcsine scale function: incoming values are buffered
+// and folded into the sorted centroid list whenever the buffer fills up.
+class TDigest {
+public:
+    struct Centroid {
+        double mean, weight;
+        bool operator<(const Centroid& o) const { return mean < o.mean; }
+    };
+
+    static constexpr double max_compression = 1e5;
+
+    explicit TDigest(double compression = 100) : delta(compression) {
+        if (!(compression >= 10 && compression <= max_compression)) {
+            throw std::invalid_argument("t-digest compression must be between 10 and 1e5");
+        }
+    }
+
+    void update(const double* x, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (std::isnan(x[i])) continue;
+            buffer.push_back({x[i], 1});
+            if (buffer.size() >= buffer_limit()) compress();
+        }
+    }
+
+    // Centroid means lie inside the data range, so the extremes are taken from o itself.
+    void merge(const TDigest& o) {
+        if (o.delta != delta) throw std::invalid_argument("cannot merge t-digests of different compression");
+        if (&o == this) {
+            TDigest copy = o;
+            merge(copy);
+            return;
+        }
+        for (const auto& c : o.centroids) buffer.push_back(c);
+        buffer.insert(buffer.end(), o.buffer.begin(), o.buffer.end());
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+        compress();
+    }
+
+    double quantile(double q) {
+        compress();
+        if (centroids.empty()) return std::nan("");
+        if (q <= 0) return min;
+        if (q >= 1) return max;
+        double target = q * total, cum = 0;
+        double prev_center = 0, prev_mean = min;
+        for (const auto& c : centroids) {
+            double center = cum + c.weight / 2;
+            if (target < center) {
+                double t = (target - prev_center) / (center - prev_center);
+                return prev_mean + t * (c.mean - prev_mean);
+            }
+            prev_center = center;
+            prev_mean = c.mean;
+            cum += c.weight;
+        }
+        double t = (target - prev_center) / (total - prev_center);
+        return prev_mean + t * (max - prev_mean);
+    }
+
+    double count() {
+        compress();
+        return total;
+    }
+
+    size_t size() {
+        compress();
+        return centroids.size();
+    }
+
+    std::string serialize() {
+        compress();
+        ByteWriter w;
+        w.put<uint8_t>('T');
+        w.put(delta);
+        w.put(min);
+        w.put(max);
+        w.put(uint32_t(centroids.size()));
+        for (const auto& c : centroids) {
+            w.put(c.mean);
+            w.put(c.weight);
+        }
+        return w.out;
+    }
+
+    // The bytes may come from anywhere, so every field is checked against what serialize() can
+    // produce before it is trusted: sorted means inside [min, max] and finite positive weights.
+    static TDigest deserialize(const std::string& s) {
+        ByteReader r(s);
+        r.expect('T');
+        TDigest t(r.get<double>());
+        t.min = r.get<double>();
+        t.max = r.get<double>();
+        uint32_t count = r.get<uint32_t>();
+        if (count > t.capacity()) throw std::invalid_argument("corrupt t-digest: too many centroids");
+        if (count && !(t.min <= t.max)) throw std::invalid_argument("corrupt t-digest: bad extremes");
+        double prev = t.min;
+        for (uint32_t i = 0; i < count; i++) {
+            double mean = r.get<double>(), weight = r.get<double>();
+            if (!(mean >= prev && mean <= t.max) || !(weight > 0 && std::isfinite(weight))) {
+                throw std::invalid_argument("corrupt t-digest centroid");
+            }
+            t.centroids.push_back({mean, weight});
+            t.total += weight;
+            prev = mean;
+        }
+        if (!std::isfinite(t.total)) throw std::invalid_argument("corrupt t-digest: total weight overflows");
+        return t;
+    }
+
+    double compression() const { return delta; }
+
+private:
+    double delta;
+    double total = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    std::vector<Centroid> centroids, buffer;
+
+    size_t buffer_limit() const { return size_t(delta) * 8; }
+
+    // Compressed centroids are at least one scale unit apart in pairs, so there are at most about delta of them.
+    size_t capacity() const { return size_t(delta); }
+
+    // Quantile limit of a centroid that starts at quantile q: one unit further along the scale function.
+    double next_limit(double q) const {
+        const double pi = 3.14159265358979323846;
+        double k = delta / (2 * pi) * std::asin(2 * q - 1) + 1;
+        if (k >= delta / 4) return 1;
+        return (std::sin(k * 2 * pi / delta) + 1) / 2;
+    }
+
+    void compress() {
+        if (buffer.empty()) return;
+        for (const auto& c : buffer) {
+            min = std::min(min, c.mean);
+            max = std::max(max, c.mean);
+            total += c.weight;
+        }
+        std::sort(buffer.begin(), buffer.end());
+        std::vector<Centroid> all(centroids.size() + buffer.size());
+        std::merge(centroids.begin(), centroids.end(), buffer.begin(), buffer.end(), all.begin());
+        buffer.clear();
+
+        centroids.clear();
+        Centroid cur = all[0];
+        double before = 0, limit = next_limit(0);
+        for (size_t i = 1; i < all.size(); i++) {
+            const Centroid& c = all[i];
+            if ((before + cur.weight + c.weight) / total <= limit) {
+                cur.weight += c.weight;
+                cur.mean += (c.mean - cur.mean) * c.weight / cur.weight;
+            } else {
+                before += cur.weight;
+                centroids.push_back(cur);
+                limit = next_limit(before / total);
+                cur = c;
+            }
+        }
+        centroids.push_back(cur);
+    }
+};
+
+// HyperLogLog distinct counter with 2^p six-bit registers over a 64-bit hash of each value's bits.
+class HyperLogLog {
+public:
+    explicit HyperLogLog(int precision = 14) : p(precision) {
+        if (p < 4 || p > 18) throw std::invalid_argument("HyperLogLog precision must be in [4, 18]");
+        registers.assign(size_t(1) << p, 0);
+    }
+
+    SIMD_CLONES void update(const double* x, size_t len) {
+        uint8_t* reg = registers.data();
+        for (size_t i = 0; i < len; i++) {
+            uint64_t h = hash(x[i]);
+            uint64_t rest = (h << p) | (uint64_t(1) << (p - 1));
+            uint8_t rank = uint8_t(__builtin_clzll(rest) + 1);
+            uint8_t& r = reg[h >> (64 - p)];
+            r = std::max(r, rank);
+        }
+    }
+
+    void merge(const HyperLogLog& o) {
+        if (o.p != p) throw std::invalid_argument("cannot merge HyperLogLog sketches of different precision");
+        for (size_t i = 0; i < registers.size(); i++) registers[i] = std::max(registers[i], o.registers[i]);
+    }
+
+    double count() const {
+        double m = double(registers.size()), sum = 0;
+        size_t zeros = 0;
+        for (uint8_t r : registers) {
+            sum += std::ldexp(1.0, -r);
+            zeros += r == 0;
+        }
+        double alpha = 0.7213 / (1 + 1.079 / m);
+        double estimate = alpha * m * m / sum;
+        if (estimate <= 2.5 * m && zeros > 0) estimate = m * std::log(m / zeros);
+        return estimate;
+    }
+
+    int precision() const { return p; }
+
+    // Registers are packed four to three bytes.
+    std::string serialize() const {
+        ByteWriter w;
+        w.put<uint8_t>('H');
+        w.put<uint8_t>(uint8_t(p));
+        for (size_t i = 0; i < registers.size(); i += 4) {
+            uint32_t packed = registers[i] | registers[i + 1] << 6 | registers[i + 2] << 12 | registers[i + 3] << 18;
+            w.put<uint8_t>(packed & 0xff);
+            w.put<uint8_t>((packed >> 8) & 0xff);
+            w.put<uint8_t>(packed >> 16);
+        }
+        return w.out;
+    }
+
+    static HyperLogLog deserialize(const std::string& s) {
+        ByteReader r(s);
+        r.expect('H');
+        HyperLogLog h(r.get<uint8_t>());
+        for (size_t i = 0; i < h.registers.size(); i += 4) {
+            uint32_t packed = r.get<uint8_t>();
+            packed |= uint32_t(r.get<uint8_t>()) << 8;
+            packed |= uint32_t(r.get<uint8_t>()) << 16;
+            for (size_t j = 0; j < 4; j++) h.registers[i + j] = (packed >> (6 * j)) & 0x3f;
+        }
+        return h;
+    }
+
+private:
+    int p;
+    std::vector<uint8_t> registers;
+
+    // splitmix64 finalizer over the value's bits, with -0.0 folded onto 0.0.
+    static uint64_t hash(double v) {
+        v += 0.0;
+        uint64_t z;
+        std::memcpy(&z, &v, sizeof(z));
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+// Moments, quantiles and distinct count of a buffer in a single pass over memory: every
+// part feeds each cache-sized block to all three sketches, then the part sketches merge in
+// order. Parts have a fixed size, so the result does not depend on the thread count.
+struct Sketches {
+    Moments moments;
+    TDigest digest;
+    HyperLogLog distinct;
+};
+
+inline Sketches build_sketches(const double* x, size_t len, double compression, int precision) {
+    const size_t block = 4096, part = 1 << 18;
+    std::vector<Sketches> parts(std::max<size_t>(1, (len + part - 1) / part),
+                                Sketches{Moments(), TDigest(compression), HyperLogLog(precision)});
+    parallel_invoke(parts.size(), [&](size_t c) {
+        for (size_t i = c * part, end = std::min(len, (c + 1) * part); i < end; i += block) {
+            size_t count = std::min(block, end - i);
+            parts[c].moments.update(x + i, count);
+            parts[c].digest.update(x + i, count);
+            parts[c].distinct.update(x + i, count);
+        }
+    });
+    Sketches result = parts[0];
+    for (size_t c = 1; c < parts.size(); c++) {
+        result.moments.merge(parts[c].moments);
+        result.digest.merge(parts[c].digest);
+        result.distinct.merge(parts[c].distinct);
+    }
+    return result;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+// Unsigned integer with the same width as the floating point type T.
+template <typename T>
+using radix_key_t = typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type;
+
+// Map an IEEE float onto an unsigned key with the same ordering: positive values get the
+// sign bit set, negative values are bit-inverted. NaNs end up at the extremes.
+template <typename T>
+inline radix_key_t<T> float_to_key(T v) {
+    using U = radix_key_t<T>;
+    const U sign = U(1) << (sizeof(U) * 8 - 1);
+    U bits;
+    std::memcpy(&bits, &v, sizeof(v));
+    return (bits & sign) ? ~bits : (bits | sign);
+}
+
+template <typename T>
+inline T key_to_float(radix_key_t<T> key) {
+    using U = radix_key_t<T>;
+    const U sign = U(1) << (sizeof(U) * 8 - 1);
+    U bits = (key & sign) ? (key ^ sign) : ~key;
+    T v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+const size_t sort_grain = 1 << 16;
+
+// Ascending LSD radix sort, one byte per pass. Every pass builds per-chunk histograms
+// in parallel and then scatters each chunk stably into its slot of the output.
+template <typename T>
+void radix_sort(T* data, size_t n) {
+    using U = radix_key_t<T>;
+    if (n < sort_grain) {
+        std::sort(data, data + n, [](T a, T b) { return float_to_key(a) < float_to_key(b); });
+        return;
+    }
+    std::vector<U> keys(n), tmp(n);
+    size_t threads = num_workers(), chunks = parallel_chunks(n, sort_grain, threads);
+    size_t step = (n + chunks - 1) / chunks;
+    std::vector<size_t> hist(chunks * 256);
+
+    parallel_for(n, sort_grain, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) keys[i] = float_to_key(data[i]);
+    }, threads);
+
+    for (size_t shift = 0; shift < sizeof(U) * 8; shift += 8) {
+        std::fill(hist.begin(), hist.end(), 0);
+        parallel_invoke(chunks, [&](size_t c) {
+            size_t* h = &hist[c * 256];
+            for (size_t i = c * step, end = std::min(n, (c + 1) * step); i < end; i++) {
+                h[(keys[i] >> shift) & 0xff]++;
+            }
+        }, threads);
+
+        // Skip the pass when every key shares this byte.
+        bool trivial = false;
+        for (size_t d = 0; d < 256 && !trivial; d++) {
+            size_t total = 0;
+            for (size_t c = 0; c < chunks; c++) total += hist[c * 256 + d];
+            trivial = total == n;
+        }
+        if (trivial) continue;
+
+        size_t offset = 0;
+        for (size_t d = 0; d < 256; d++) {
+            for (size_t c = 0; c < chunks; c++) {
+                size_t count = hist[c * 256 + d];
+                hist[c * 256 + d] = offset;
+                offset += count;
+            }
+        }
+        parallel_invoke(chunks, [&](size_t c) {
+            size_t* h = &hist[c * 256];
+            for (size_t i = c * step, end = std::min(n, (c + 1) * step); i < end; i++) {
+                tmp[h[(keys[i] >> shift) & 0xff]++] = keys[i];
+            }
+        }, threads);
+        keys.swap(tmp);
+    }
+
+    parallel_for(n, sort_grain, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) data[i] = key_to_float<T>(keys[i]);
+    }, threads);
+}
+
+// Stable ascending argsort: every chunk is sorted independently, then sorted runs
+// are merged pairwise until a single run remains. Each merge round runs in parallel.
+template <typename T>
+void argsort(const T* data, int64_t* idx, size_t n) {
+    auto less = [data](int64_t a, int64_t b) { return float_to_key(data[a]) < float_to_key(data[b]); };
+    // The runs merged below are the chunks parallel_for sorts, so both use the same thread count.
+    size_t threads = num_workers(), chunks = parallel_chunks(n, sort_grain, threads);
+    size_t step = (n + chunks - 1) / chunks;
+
+    parallel_for(n, sort_grain, [&](size_t, size_t begin, size_t end) {
+        std::iota(idx + begin, idx + end, int64_t(begin));
+        std::stable_sort(idx + begin, idx + end, less);
+    }, threads);
+    if (chunks == 1) return;
+
+    std::vector<int64_t> tmp(n);
+    int64_t* src = idx;
+    int64_t* dst = tmp.data();
+    for (size_t width = step; width < n; width *= 2) {
+        size_t pairs = (n + 2 * width - 1) / (2 * width);
+        parallel_invoke(pairs, [&](size_t p) {
+            size_t lo = p * 2 * width;
+            size_t mid = std::min(n, lo + width);
+            size_t hi = std::min(n, lo + 2 * width);
+            std::merge(src + lo, src + mid, src + mid, src + hi, dst + lo, less);
+        }, threads);
+        std::swap(src, dst);
+    }
+    if (src != idx) std::copy(src, src + n, idx);
+}
+
+// The k largest (or smallest) values with their indices, best first. Small k keeps a
+// bounded heap per chunk; large k falls back to quickselect over an index array.
+template <typename T>
+std::vector<std::pair<T, int64_t>> topk(const T* data, size_t n, size_t k, bool largest) {
+    using U = radix_key_t<T>;
+    using entry = std::pair<U, int64_t>;
+    k = std::min(k, n);
+    auto key = [&](size_t i) -> U {
+        U kv = float_to_key(data[i]);
+        return largest ? kv : ~kv;
+    };
+    // Ranks by key descending, ties broken by lower index.
+    auto better = [](const entry& a, const entry& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    };
+
+    std::vector<entry> best;
+    size_t threads = num_workers();
+    if (k * threads * 8 <= n) {
+        size_t chunks = parallel_chunks(n, sort_grain, threads);
+        std::vector<std::vector<entry>> heaps(chunks);
+        parallel_for(n, sort_grain, [&](size_t c, size_t begin, size_t end) {
+            std::priority_queue<entry, std::vector<entry>, decltype(better)> heap(better);
+            for (size_t i = begin; i < end && k > 0; i++) {
+                entry e(key(i), int64_t(i));
+                if (heap.size() < k) {
+                    heap.push(e);
+                } else if (better(e, heap.top())) {
+                    heap.pop();
+                    heap.push(e);
+                }
+            }
+            for (; !heap.empty(); heap.pop()) heaps[c].push_back(heap.top());
+        }, threads);
+        for (auto& h : heaps) best.insert(best.end(), h.begin(), h.end());
+    } else {
+        best.resize(n);
+        parallel_for(n, sort_grain, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) best[i] = entry(key(i), int64_t(i));
+        }, threads);
+    }
+    k = std::min(k, best.size());
+    std::nth_element(best.begin(), best.begin() + k, best.end(), better);
+    best.resize(k);
+    std::sort(best.begin(), best.end(), better);
+
+    std::vector<std::pair<T, int64_t>> out;
+    out.reserve(k);
+    for (auto& e : best) out.emplace_back(data[e.second], e.second);
+    return out;
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+// Memory behind one or more Vectors. Subclasses decide where it comes from; views keep it
+// alive through shared ownership.
+struct Storage {
+    double* data = nullptr;
+    size_t size = 0;
+    bool readonly = false;
+    virtual ~Storage() = default;
+};
+
+// Bytes for n doubles. Sizes whose byte count, rounded up to whole pages, would not fit in a
+// size_t (or an off_t, for spill files) throw bad_alloc instead of wrapping around.
+inline size_t storage_bytes(size_t n) {
+    if (n > (SIZE_MAX >> 1) / sizeof(double)) throw std::bad_alloc();
+    return n * sizeof(double);
+}
+
+// Cache-line aligned heap memory, left uninitialized for the kernel that fills it.
+struct HeapStorage : Storage {
+    explicit HeapStorage(size_t n) {
+        size_t bytes = std::max<size_t>(64, (storage_bytes(n) + 63) / 64 * 64);
+        data = static_cast<double*>(std::aligned_alloc(64, bytes));
+        if (!data) throw std::bad_alloc();
+        size = n;
+    }
+    ~HeapStorage() override { std::free(data); }
+};
+
+// Allocations of at least `threshold` bytes go to a file in `directory` instead of anonymous
+// memory (0 disables spilling).
+struct SpillConfig {
+    std::atomic<size_t> threshold{0};
+    std::mutex lock;
+    std::string directory;
+
+    std::string dir() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!directory.empty()) return directory;
+        const char* tmp = std::getenv("TMPDIR");
+        return tmp && *tmp ? tmp : "/tmp";
+    }
+};
+
+inline SpillConfig& spill_config() {
+    static SpillConfig config;
+    return config;
+}
+
+// A shared mapping of a scratch file. Its pages are written back to the file under memory
+// pressure instead of growing anonymous memory. The storage owns the file and removes it when
+// freed; another process on the same node may map it before then (map_spill in mapping.h), and
+// its mapping stays valid after the file is gone.
+struct SpillStorage : Storage {
+    std::string path;
+    size_t bytes;
+
+    explicit SpillStorage(size_t n) : bytes(std::max<size_t>(storage_bytes(n), 1)) {
+        std::string name = spill_config().dir() + "/cpparthimetic-XXXXXX";
+        std::vector<char> buf(name.begin(), name.end());
+        buf.push_back('\0');
+        int fd = ::mkstemp(buf.data());
+        if (fd < 0) throw std::runtime_error("cannot create spill file in " + spill_config().dir());
+        path = buf.data();
+        int err = ::posix_fallocate(fd, 0, off_t(bytes));
+        if (err == EINVAL || err == EOPNOTSUPP) err = ::ftruncate(fd, off_t(bytes)) ? errno : 0;
+        void* p = err ? MAP_FAILED : ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            ::unlink(path.c_str());
+            throw std::runtime_error("cannot allocate spill file " + path);
+        }
+        data = static_cast<double*>(p);
+        size = n;
+    }
+
+    ~SpillStorage() override {
+        ::munmap(data, bytes);
+        ::unlink(path.c_str());
+    }
+};
+
+const size_t huge_page_size = size_t(2) << 20;
+
+// Allocations of at least `threshold` bytes (0 disables) are mapped 2 MB aligned and advised for
+// transparent huge pages, or taken from the hugetlbfs pool first when `hugetlb` is set. The
+// counters are cumulative; live ranges are kept so huge_page_usage() can find them in smaps.
+// Pages are faulted in on first touch unless `prefault` asks for it at allocation, which costs a
+// full extra pass over memory the caller may never write.
+struct HugePageConfig {
+    std::atomic<size_t> threshold{size_t(32) << 20};
+    std::atomic<bool> hugetlb{false};
+    std::atomic<bool> prefault{false};
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> hugetlb_allocations{0};
+    std::atomic<size_t> hugetlb_fallbacks{0};
+    std::mutex lock;
+    std::vector<std::pair<uintptr_t, uintptr_t>> live;
+};
+
+inline HugePageConfig& huge_page_config() {
+    static HugePageConfig config;
+    return config;
+}
+
+// Anonymous memory in whole 2 MB pages. Prefaulting touches every page from parallel_for
+// chunks, so the fault storm is spread over the workers and each chunk's pages are placed on
+// the NUMA node of the thread that will most likely process it.
+struct HugePageStorage : Storage {
+    size_t bytes;
+    bool hugetlb = false;
+
+    explicit HugePageStorage(size_t n)
+        : bytes(std::max<size_t>(1, (storage_bytes(n) + huge_page_size - 1) / huge_page_size) * huge_page_size) {
+        HugePageConfig& config = huge_page_config();
+        void* p = MAP_FAILED;
+        if (config.hugetlb) {
+            p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            hugetlb = p != MAP_FAILED;
+            (hugetlb ? config.hugetlb_allocations : config.hugetlb_fallbacks)++;
+        }
+        if (p == MAP_FAILED) p = map_aligned();
+        data = static_cast<double*>(p);
+        size = n;
+        // The destructor does not run if the constructor throws, so unmap here on failure.
+        try {
+            if (config.prefault) prefault();
+            std::lock_guard<std::mutex> guard(config.lock);
+            config.live.emplace_back(uintptr_t(data), uintptr_t(data) + bytes);
+        } catch (...) {
+            ::munmap(data, bytes);
+            throw;
+        }
+        config.allocations++;
+    }
+
+    ~HugePageStorage() override {
+        HugePageConfig& config = huge_page_config();
+        {
+            std::lock_guard<std::mutex> guard(config.lock);
+            auto& live = config.live;
+            live.erase(std::find(live.begin(), live.end(), std::make_pair(uintptr_t(data), uintptr_t(data) + bytes)));
+        }
+        ::munmap(data, bytes);
+    }
+
+    // Over-map by one huge page and trim both ends so the range starts on a 2 MB boundary; the
+    // fault handler and khugepaged only use huge pages for aligned 2 MB extents.
+    void* map_aligned() {
+        size_t padded = bytes + huge_page_size;
+        void* raw = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) throw std::bad_alloc();
+        uintptr_t begin = uintptr_t(raw), aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+        if (aligned > begin) ::munmap(raw, aligned - begin);
+        size_t tail = begin + padded - (aligned + bytes);
+        if (tail) ::munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+#ifdef MADV_HUGEPAGE
+        ::madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void prefault() {
+        volatile char* base = reinterpret_cast<char*>(data);
+        long page = ::sysconf(_SC_PAGESIZE);
+        size_t step = page > 0 ? size_t(page) : 4096;
+        parallel_for(bytes / huge_page_size, 4, [&](size_t, size_t begin, size_t end) {
+            for (size_t off = begin * huge_page_size; off < end * huge_page_size; off += step) base[off] = 0;
+        });
+    }
+};
+
+// How the live HugePageStorage ranges are backed, from /proc/self/smaps: bytes mapped, bytes
+// resident, and resident bytes in transparent or hugetlbfs huge pages.
+struct HugePageUsage {
+    size_t mapped = 0;
+    size_t resident = 0;
+    size_t huge = 0;
+};
+
+inline HugePageUsage huge_page_usage() {
+    HugePageConfig& config = huge_page_config();
+    std::vector<std::pair<uintptr_t, uintptr_t>> live;
+    {
+        std::lock_guard<std::mutex> guard(config.lock);
+        live = config.live;
+    }
+    HugePageUsage usage;
+    for (const auto& r : live) usage.mapped += r.second - r.first;
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool ours = false;
+    while (std::getline(smaps, line)) {
+        unsigned long begin, end, kb;
+        char field[64];
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &begin, &end) == 2) {
+            // A mapping header. Neighbouring advised ranges may be merged into one mapping, so
+            // any mapping overlapping a live range counts.
+            ours = std::any_of(live.begin(), live.end(), [&](const std::pair<uintptr_t, uintptr_t>& r) {
+                return r.first < end && begin < r.second;
+            });
+        } else if (ours && std::sscanf(line.c_str(), "%63[^:]: %lu kB", field, &kb) == 2) {
+            std::string name = field;
+            if (name == "Rss") usage.resident += kb << 10;
+            if (name == "AnonHugePages" || name == "Private_Hugetlb" || name == "Shared_Hugetlb") usage.huge += kb << 10;
+        }
+    }
+    return usage;
+}
+
+inline std::shared_ptr<Storage> allocate_storage(size_t n) {
+    size_t bytes = storage_bytes(n), threshold = spill_config().threshold.load();
+    if (threshold && bytes >= threshold) return std::make_shared<SpillStorage>(n);
+    size_t huge = huge_page_config().threshold.load();
+    if (huge && bytes >= huge) return std::make_shared<HugePageStorage>(n);
+    return std::make_shared<HeapStorage>(n);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+#include <cstddef>
+#include <string>
+
+#include "autotune.h"
+#include "kernels.h"
+#include "vector.h"
+
+namespace py = pybind11;
+
+const size_t max_stream_chunk = size_t(1) << 24;  // 128 MB per input buffer
+
+// An elementwise op over two Python iterables of numbers (generators, file readers, ...), applied
+// chunk_size pairs at a time. The input chunks are read into two buffers reused for the whole
+// stream, so memory stays bounded however long the stream is.
+
+class BinaryStream {
+public:
+    BinaryStream(const py::iterable& a, const py::iterable& b, const BinaryOp& op, size_t chunk_size, const char* name)
+        : left(py::iter(a)), right(py::iter(b)), op(op), name(name), x(checked_chunk(chunk_size, name)),
+          y(chunk_size) {}
+
+    // The next chunk of results as a new Vector; raises StopIteration at the end of the inputs.
+    Vector next() {
+        size_t n = fill();
+        if (n == 0) throw py::stop_iteration();
+        Vector c(n);
+        apply(n, c);
+        return c;
+    }
+
+    // Pass every chunk of results to sink (a callable such as list.extend or file.write) and return
+    // the number of elements written. The sink is handed the same buffer each time, overwritten by
+    // the next chunk, so it must copy what it keeps.
+    size_t drain(const py::object& sink) {
+        Vector c(x.size());
+        size_t total = 0;
+        while (size_t n = fill()) {
+            Vector chunk = c.slice(0, n);
+            apply(n, chunk);
+            sink(chunk);
+            total += n;
+        }
+        return total;
+    }
+
+private:
+    py::iterator left, right;
+    const BinaryOp& op;
+    const char* name;
+    Vector x, y;
+    bool finished = false;
+
+    static size_t checked_chunk(size_t chunk_size, const char* name) {
+        if (chunk_size == 0 || chunk_size > max_stream_chunk) {
+            throw py::value_error(std::string(name) + ": chunk_size must be between 1 and " +
+                                  std::to_string(max_stream_chunk));
+        }
+        return chunk_size;
+    }
+
+    // Read up to chunk_size pairs into x and y; 0 once both inputs are exhausted.
+    size_t fill() {
+        size_t n = 0, chunk = x.size();
+        while (!finished && n < chunk) {
+            py::object va = py::reinterpret_steal<py::object>(PyIter_Next(left.ptr()));
+            if (!va && PyErr_Occurred()) throw py::error_already_set();
+            py::object vb = py::reinterpret_steal<py::object>(PyIter_Next(right.ptr()));
+            if (!vb && PyErr_Occurred()) throw py::error_already_set();
+            if (!va || !vb) {
+                finished = true;
+                if (va || vb) throw py::value_error(std::string(name) + ": inputs must have the same length");
+                break;
+            }
+            x.data()[n] = number(va);
+            y.data()[n] = number(vb);
+            n++;
+        }
+        return n;
+    }
+
+    static double number(const py::object& v) {
+        if (PyFloat_CheckExact(v.ptr())) return PyFloat_AS_DOUBLE(v.ptr());
+        double d = PyFloat_AsDouble(v.ptr());
+        if (d == -1.0 && PyErr_Occurred()) throw py::error_already_set();
+        return d;
+    }
+
+    void apply(size_t n, Vector& c) {
+        Vector xa = x.slice(0, n), ya = y.slice(0, n);
+        py::gil_scoped_release release;
+        elementwise_into(xa, ya, c, op, tuned_params());
+    }
+};
@@ -0,0 +1,618 @@
+"""Behaviour tests for the cpparthimetic module.
+
+Build the module in place first, then run from this directory:
+
+    python setup.py build_ext --inplace
+    python -m unittest test_cpparthimetic
+"""
+
+import array
+import copy
+import math
+import os
+import pickle
+import struct
+import sys
+import tempfile
+import threading
+import unittest
+
+# Keep the tests off the user's tuning cache.
+os.environ["HPC_TUNING_CACHE"] = os.path.join(tempfile.mkdtemp(), "tuning")
+
+import cpparthimetic as cpp  # noqa: E402
+
+
+class ExpressionTest(unittest.TestCase):
+    def test_matches_python(self):
+        a, b = [1.0, 2.0, 3.0], [4.0, 5.0, 6.0]
+        got = cpp.evaluate("(a + b) / (b * b + 1)", a=a, b=b)
+        self.assertEqual(list(got), [(x + y) / (y * y + 1) for x, y in zip(a, b)])
+
+    def test_nan_constant(self):
+        got = cpp.evaluate("x + 0/0", x=[1.0, 2.0])
+        self.assertTrue(all(math.isnan(v) for v in got))
+
+    def test_negative_zero_constant(self):
+        self.assertEqual(list(cpp.evaluate("0.0 + x / -0.0", x=[1.0])), [-math.inf])
+
+    def test_compiled_expression(self):
+        e = cpp.Expression("a * a + b")
+        self.assertEqual((e.text, e.variables), ("a * a + b", ["a", "b"]))
+        self.assertTrue(e.disassemble())
+        self.assertEqual(list(e(a=[1.0, 2.0], b=10)), [11.0, 14.0])
+
+    def test_missing_variable(self):
+        with self.assertRaises(ValueError):
+            cpp.evaluate("a + b", a=[1.0])
+
+    def test_nesting_is_limited(self):
+        for text in ("(" * 100000 + "x" + ")" * 100000, "-" * 100000 + "x", "+x" * 100000):
+            with self.assertRaisesRegex(ValueError, "too deeply nested"):
+                cpp.evaluate(text.lstrip("+"), x=[1.0])
+        self.assertEqual(list(cpp.evaluate("(" * 100 + "x" + ")" * 100, x=[2.0])), [2.0])
+
+
+class TuningTest(unittest.TestCase):
+    def test_no_calibration_without_retune(self):
+        self.assertIn(cpp.tuning()["source"], ("default", "override"))
+
+    def test_tuning_leaves_other_kernels_alone(self):
+        cpp.set_workers(3)
+        try:
+            cpp.set_tuning(threads=1)
+            self.assertEqual(cpp.workers(), 3)
+        finally:
+            cpp.set_workers(0)
+
+    def test_override(self):
+        got = cpp.set_tuning(threads=2, grain=4096)
+        self.assertEqual((got["source"], got["threads"], got["grain"]), ("override", 2, 4096))
+        self.assertEqual(cpp.tuning()["grain"], 4096)
+
+    def test_retune(self):
+        got = cpp.retune()
+        self.assertEqual(got["source"], "calibrated")
+        self.assertGreaterEqual(got["threads"], 1)
+
+    def test_persist_from_many_threads(self):
+        cache = os.environ["HPC_TUNING_CACHE"]
+        calls = [threading.Thread(target=cpp.set_tuning, kwargs={"grain": 1024 * (i + 1), "persist": True})
+                 for i in range(8)]
+        for t in calls:
+            t.start()
+        for t in calls:
+            t.join()
+        with open(cache) as f:
+            self.assertIn("cpparthimetic.grain", f.read())
+        self.assertEqual(os.listdir(os.path.dirname(cache)), [os.path.basename(cache)])  # no stray temporaries
+
+
+class PoolTest(unittest.TestCase):
+    def test_pool_is_shared_with_other_modules(self):
+        sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir, "cpiapprox"))
+        try:
+            import cpiapprox
+        except ImportError:
+            self.skipTest("cpiapprox is not built")
+        cpp.set_workers(4)  # start the pool from this module
+        try:
+            cpp.segment_scan([1.0] * (1 << 17), [0, 1 << 17], "sum")
+        finally:
+            cpp.set_workers(0)
+        self.assertTrue(cpiapprox.diagnostics()["pool_started"])
+
+
+class MaskedTest(unittest.TestCase):
+    def test_out_is_written_in_place(self):
+        out = array.array("d", [9.0] * 3)
+        got = cpp.vecadd([1.0, 2.0, 3.0], [1.0, 1.0, 1.0], where=bytes([1, 0, 1]), out=out)
+        self.assertIs(got, out)
+        self.assertEqual(list(out), [2.0, 9.0, 4.0])
+
+    def test_out_must_be_writable_float64(self):
+        for out in ([0.0] * 3, bytes(24), array.array("f", [0.0] * 3), memoryview(array.array("d", [0.0] * 3)).toreadonly()):
+            with self.assertRaises(TypeError):
+                cpp.vecmul([1.0] * 3, [1.0] * 3, where=bytes(3), out=out)
+
+    def test_bitmask_where(self):
+        x = [1.0, -2.0, 3.0]
+        mask = cpp.compare(x, 0.0, ">")
+        self.assertEqual(list(cpp.select(x, mask)), [1.0, 3.0])
+        self.assertEqual(list(cpp.vecadd(x, x, where=mask)), [2.0, 0.0, 6.0])
+
+    def test_bitmask_length_must_match(self):
+        mask = cpp.compare([1.0] * 3, 0.0, ">")
+        with self.assertRaises(ValueError):
+            cpp.select([1.0, 2.0], mask)
+        with self.assertRaises(ValueError):
+            cpp.vecadd([1.0] * 4, [1.0] * 4, where=mask)
+
+
+class ScatterTest(unittest.TestCase):
+    def test_take(self):
+        self.assertEqual(list(cpp.take([1.0, 2.0, 3.0], [2, 0, 2])), [3.0, 1.0, 3.0])
+        for bad in ([1], [-1]):
+            with self.assertRaises(IndexError):
+                cpp.take([1.0], bad)
+
+    def test_put_and_scatter_add_write_in_place(self):
+        target = array.array("d", [0.0] * 4)
+        cpp.put(target, [1, 3], [5.0, 6.0])
+        cpp.scatter_add(target, [1, 1, 2], [1.0, 1.0, 1.0])
+        self.assertEqual(list(target), [0.0, 7.0, 1.0, 6.0])
+
+    def test_target_must_be_writable_float64(self):
+        for target in ([0.0] * 4, bytes(32), memoryview(array.array("d", [0.0] * 4)).toreadonly()):
+            for f in (cpp.put, cpp.scatter_add):
+                with self.assertRaises(TypeError):
+                    f(target, [0], [1.0])
+
+
+class SketchTest(unittest.TestCase):
+    def digest(self, start, compression=100):
+        d = cpp.TDigest(compression)
+        d.update(array.array("d", range(start, start + 5000)))
+        return d
+
+    def test_merge_keeps_extremes(self):
+        a, b = self.digest(0), self.digest(10000)
+        b.quantile(0.5)  # fold b's buffer into centroids
+        a.merge(b)
+        self.assertEqual((a.quantile(0), a.quantile(1)), (0.0, 14999.0))
+
+    def test_merge_needs_same_compression(self):
+        with self.assertRaises(ValueError):
+            self.digest(0).merge(self.digest(0, 50))
+
+    def test_moments(self):
+        m = cpp.Moments()
+        m.update(array.array("d", [1.0, 2.0, 3.0, 4.0]))
+        self.assertEqual((m.count, m.mean, m.min, m.max), (4, 2.5, 1.0, 4.0))
+        self.assertAlmostEqual(m.variance(ddof=1), 5 / 3)
+        self.assertAlmostEqual(m.skewness, 0.0)
+
+    def test_hyperloglog(self):
+        h = cpp.HyperLogLog(12)
+        h.update(array.array("d", [float(i % 1000) for i in range(10000)]))
+        self.assertEqual(h.precision, 12)
+        self.assertAlmostEqual(h.count, 1000, delta=50)
+
+    def test_sketch_and_round_trips(self):
+        moments, digest, distinct = cpp.sketch(array.array("d", range(1000)))
+        self.assertEqual(moments.count, 1000)
+        self.assertEqual(digest.quantile(1), 999.0)
+        for s in (moments, digest, distinct):
+            for copy_ in (type(s).from_bytes(s.to_bytes()), pickle.loads(pickle.dumps(s))):
+                self.assertEqual(copy_.count, s.count)
+
+    def test_corrupt_digest_bytes(self):
+        data = self.digest(0).to_bytes()
+        patches = [(1, math.nan), (1, 1e300), (29, math.nan), (37, -1.0), (37, math.inf)]  # compression, mean, weight
+        for at, value in patches:
+            with self.assertRaises(ValueError):
+                cpp.TDigest.from_bytes(data[:at] + struct.pack("<d", value) + data[at + 8:])
+        with self.assertRaises(ValueError):
+            cpp.TDigest.from_bytes(data[:25] + struct.pack("<I", 1000) + data[29:])  # centroid count
+
+
+class ArrowTest(unittest.TestCase):
+    def setUp(self):
+        self.path = os.path.join(tempfile.mkdtemp(), "values.arrows")
+
+    def test_round_trip(self):
+        cpp.write_arrow(self.path, [1.0, 2.0, 3.0], batch_size=2, stream=True)
+        self.assertEqual([list(b) for b in cpp.read_arrow(self.path)], [[1.0, 2.0], [3.0]])
+
+    def test_corrupt_row_count(self):
+        cpp.write_arrow(self.path, [float(i) for i in range(333)], stream=True)
+        with open(self.path, "rb") as f:
+            data = f.read()
+        rows = struct.pack("<q", 333)
+        at = data.index(rows, data.index(rows) + 1)  # the field node after the batch length
+        for bad in (-1, 1 << 61, 334):
+            with open(self.path, "wb") as f:
+                f.write(data[:at] + struct.pack("<q", bad) + data[at + 8:])
+            with self.assertRaises(RuntimeError):
+                cpp.read_arrow(self.path)
+
+
+class ComplexTest(unittest.TestCase):
+    def test_abs_matches_hypot(self):
+        inf, nan = math.inf, math.nan
+        re = [inf, -inf, 2.0, inf, nan, nan, 3.0, 1e300, 1e-300]
+        im = [inf, 1.0, -inf, nan, -inf, 1.0, 4.0, 1e300, 1e-300]
+        want = [math.hypot(x, y) for x, y in zip(re, im)]
+        interleaved = [v for pair in zip(re, im) for v in pair]
+        for got in (cpp.cabs((re, im)), cpp.cabs(interleaved)):
+            for g, w in zip(got, want):
+                if math.isnan(w):
+                    self.assertTrue(math.isnan(g))
+                else:
+                    self.assertAlmostEqual(g, w, delta=w * 1e-15)
+
+    def test_binary_ops(self):
+        a, b = [1 + 2j, -3 + 0.5j], [2 - 1j, 0.25 + 4j]
+
+        def split(zs):
+            return [z.real for z in zs], [z.imag for z in zs]
+
+        def interleaved(zs):
+            return [v for z in zs for v in (z.real, z.imag)]
+
+        for f, op in ((cpp.cadd, lambda x, y: x + y), (cpp.cmul, lambda x, y: x * y),
+                      (cpp.cmul_conj, lambda x, y: x * y.conjugate()), (cpp.cdiv, lambda x, y: x / y)):
+            want = [op(x, y) for x, y in zip(a, b)]
+            re, im = f(split(a), split(b))
+            pairs = f(interleaved(a), interleaved(b))
+            self.assertIsInstance(pairs, cpp.Vector)
+            for got in (list(zip(re, im)), list(zip(pairs[::2], pairs[1::2]))):
+                for (r, i), w in zip(got, want):
+                    self.assertAlmostEqual(complex(r, i), w, delta=1e-15 * abs(w))
+
+    def test_layouts_must_match(self):
+        with self.assertRaises(ValueError):
+            cpp.cadd(([1.0], [2.0]), [1.0, 2.0])
+
+
+class ShuffleTest(unittest.TestCase):
+    def test_permutation(self):
+        p = cpp.permutation(100000, 7, 3)
+        self.assertEqual(sorted(p), list(range(100000)))
+        self.assertEqual(list(p), list(cpp.permutation(100000, 7, 3)))
+
+    def test_every_epoch_bit_counts(self):
+        perms = [list(cpp.permutation(1000, 1, epoch)) for epoch in (0, 1 << 16, 1 << 48, 1 << 63)]
+        self.assertEqual(len({tuple(p) for p in perms}), len(perms))
+
+    def test_shuffle_in_place(self):
+        values = array.array("d", range(1000))
+        cpp.shuffle(values, 5, epoch=1 << 20)
+        self.assertEqual(sorted(values), list(range(1000)))
+        self.assertNotEqual(list(values), list(range(1000)))
+
+
+class SegmentTest(unittest.TestCase):
+    GRAIN = 1 << 15  # segment_grain in segment.h
+
+    def test_scan_segments_starting_at_chunk_boundaries(self):
+        g = self.GRAIN
+        n = 4 * g
+        cpp.set_workers(4)  # four chunks of exactly one grain each
+        try:
+            for offsets in ([0, g, 2 * g, n], [0, 5, g, g + 3, 3 * g, n], [0, n]):
+                got = cpp.segment_scan([1.0] * n, offsets, "sum")
+                want = [float(i - start + 1) for start, stop in zip(offsets, offsets[1:]) for i in range(start, stop)]
+                self.assertEqual(list(got), want)
+        finally:
+            cpp.set_workers(0)
+
+    def test_reduce(self):
+        got = cpp.segment_reduce([1.0, 2.0, 3.0, 4.0, 5.0], [0, 2, 2, 5], "sum")
+        self.assertEqual(list(got), [3.0, 0.0, 12.0])
+
+    def test_reduce_by_key(self):
+        keys, got = cpp.reduce_by_key([7, 7, 3, 7], [1.0, 2.0, 3.0, 4.0], "max")
+        self.assertEqual((list(keys), list(got)), ([7, 3, 7], [2.0, 3.0, 4.0]))
+
+
+class StreamTest(unittest.TestCase):
+    def test_chunks(self):
+        chunks = list(cpp.vecadd_stream((float(i) for i in range(10)), iter([1.0] * 10), 4))
+        self.assertEqual([len(c) for c in chunks], [4, 4, 2])
+        self.assertEqual([v for c in chunks for v in c], [i + 1.0 for i in range(10)])
+
+    def test_sink(self):
+        out = []
+        count = cpp.vecmul_stream(range(5), range(5), 2, out=out.extend)
+        self.assertEqual((count, out), (5, [float(i * i) for i in range(5)]))
+
+    def test_length_mismatch(self):
+        with self.assertRaises(ValueError):
+            list(cpp.vecdiv_stream(range(3), range(4)))
+
+    def test_chunk_size_is_bounded(self):
+        for size in (0, 2**61):
+            with self.assertRaises(ValueError):
+                cpp.vecadd_stream([1.0], [1.0], size)
+
+
+class SpillTest(unittest.TestCase):
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        cpp.set_spill(1 << 20, self.directory)
+
+    def tearDown(self):
+        cpp.set_spill(0)
+
+    def test_settings(self):
+        self.assertEqual(cpp.spill_settings(), {"threshold": 1 << 20, "directory": self.directory})
+        cpp.set_spill(0)
+        self.assertEqual(cpp.spill_settings()["threshold"], 0)
+
+    def spilled(self):
+        n = 1 << 18
+        v = cpp.vecadd(cpp.Vector([1.0] * n), cpp.Vector([2.0] * n))
+        self.assertIsNotNone(v.file)
+        return v
+
+    def test_pickle_is_a_copy(self):
+        v = self.spilled()
+        for w in (pickle.loads(pickle.dumps(v)), copy.deepcopy(v)):
+            self.assertIsNone(w.file)
+            v[0] = 7.0
+            self.assertEqual(w[0], 3.0)
+            v[0] = 3.0
+
+    def test_file_removed_with_vector(self):
+        v = self.spilled()
+        path = v.file
+        pickle.dumps(v)
+        del v
+        self.assertFalse(os.path.exists(path))
+
+    def test_spill_handle(self):
+        v = self.spilled()
+        path, offset, length = v[10:20].spill_handle()
+        view = cpp.map_spill(path, offset, length)
+        v[10] = -1.0
+        self.assertEqual(list(view)[:2], [-1.0, 3.0])
+        with self.assertRaises(ValueError):
+            cpp.Vector([1.0]).spill_handle()
+
+
+class SortTest(unittest.TestCase):
+    def test_sort(self):
+        for code in ("d", "f"):
+            values = array.array(code, [3.0, -1.0, 2.5, -0.0, 7.0])
+            cpp.sort(values)
+            self.assertEqual(list(values), sorted([3.0, -1.0, 2.5, -0.0, 7.0]))
+
+    def test_argsort_is_stable(self):
+        order = array.array("q", [0] * 5)
+        cpp.argsort(array.array("d", [2.0, 1.0, 2.0, 1.0, 0.0]), order)
+        self.assertEqual(list(order), [4, 1, 3, 0, 2])
+
+    def test_topk(self):
+        values = array.array("d", [5.0, 1.0, 9.0, 3.0])
+        self.assertEqual(cpp.topk(values, 2), ([9.0, 5.0], [2, 0]))
+        self.assertEqual(cpp.topk(values, 1, largest=False), ([1.0], [1]))
+
+
+class GemmTest(unittest.TestCase):
+    @staticmethod
+    def matrix(rows, cols, values):
+        return memoryview(array.array("d", values)).cast("B").cast("d", [rows, cols])
+
+    def test_gemm(self):
+        a, b = self.matrix(2, 3, [1, 2, 3, 4, 5, 6]), self.matrix(3, 2, [1, 0, 0, 1, 1, 1])
+        c = self.matrix(2, 2, [1, 1, 1, 1])
+        cpp.gemm(a, b, c, alpha=2.0, beta=1.0)
+        self.assertEqual(c.tolist(), [[9.0, 11.0], [21.0, 23.0]])
+
+    def test_gemv(self):
+        a = self.matrix(2, 3, [1, 2, 3, 4, 5, 6])
+        y = array.array("d", [0.0, 0.0, 0.0])
+        cpp.gemv(a, array.array("d", [1.0, 1.0]), y, trans=True)
+        self.assertEqual(list(y), [5.0, 7.0, 9.0])
+
+
+class ListCasterTest(unittest.TestCase):
+    def test_sequences_of_numbers(self):
+        class Real(float):
+            pass
+
+        self.assertEqual(cpp.vecadd([1, 2.5, Real(1.0)], (3, 4.0, 1)), [4.0, 6.5, 2.0])
+        self.assertEqual(list(cpp.Vector((1, True, 2.5))), [1.0, 1.0, 2.5])
+
+    def test_rejects_non_numbers(self):
+        for bad in (["1.0"], "12", [None]):
+            with self.assertRaises(TypeError):
+                cpp.vecadd(bad, bad)
+
+
+class VectorTest(unittest.TestCase):
+    def test_views_and_copies(self):
+        v = cpp.Vector([0.0, 1.0, 2.0, 3.0])
+        view, copy_ = v[1:3], v[::2]
+        v[1] = 9.0
+        self.assertEqual((list(view), view.offset, list(copy_)), ([9.0, 2.0], 1, [0.0, 2.0]))
+        self.assertIsNone(v.file)
+        with self.assertRaises(IndexError):
+            v[4] = 0.0
+
+    def test_wrap_shares_memory(self):
+        data = array.array("d", [1.0, 2.0])
+        v = cpp.Vector.wrap(data)
+        data[0] = 5.0
+        self.assertEqual(v.tolist(), [5.0, 2.0])
+
+    def test_split_and_merge(self):
+        parts = cpp.split(list(map(float, range(10))), 3)
+        self.assertEqual([len(p) for p in parts], [4, 3, 3])
+        self.assertEqual(list(cpp.merge(parts)), list(map(float, range(10))))
+
+
+class CodecTest(unittest.TestCase):
+    values = [round(0.01 * i, 2) for i in range(5000)]
+
+    def test_codecs_round_trip(self):
+        for codec in ("auto", "decimal", "xor", "shuffle", "none"):
+            data = cpp.compress(self.values, codec, block_size=1024)
+            self.assertEqual(list(cpp.decompress(data)), self.values)
+            self.assertEqual(list(cpp.decompress(data, 1000, 3000)), self.values[1000:3000])
+
+    def test_save_and_load(self):
+        path = os.path.join(tempfile.mkdtemp(), "values.cpv")
+        cpp.save(path, self.values)
+        self.assertEqual(list(cpp.load(path, 10, 20)), self.values[10:20])
+
+    def test_corrupt_data(self):
+        with self.assertRaises(ValueError):
+            cpp.decompress(b"CPV1" + bytes(8))
+
+    def test_corrupt_header(self):
+        def container(count, block_size, blocks, body):
+            offsets = struct.pack("<%dQ" % (blocks + 1), *([0] * blocks + [body]))
+            return b"CPV1" + bytes(4) + struct.pack("<QII", count, block_size, blocks) + offsets + bytes(body)
+
+        # a 32 GB claim backed by 10 bytes, a count that wraps the block arithmetic, and one
+        # beyond what LZ can expand the block area to
+        for data in (container(2**32 - 1, 2**32 - 1, 1, 10), container(2**64 - 1, 2**32 - 1, 1, 10),
+                     container(1000, 1000, 1, 20)):
+            with self.assertRaises(ValueError):
+                cpp.decompress(data)
+
+
+class ReduceTest(unittest.TestCase):
+    def test_sum_and_dot(self):
+        x = [0.1 * i for i in range(1000)]
+        self.assertAlmostEqual(cpp.vecsum(x), math.fsum(x), delta=1e-9)
+        self.assertAlmostEqual(cpp.vecdot(x, x), math.fsum(v * v for v in x), delta=1e-6)
+
+    def test_reproducible_for_any_thread_count(self):
+        x = [math.sin(i) * 10 ** (i % 7) for i in range(1 << 18)]
+        results = set()
+        for threads in (1, 3, 8):
+            cpp.set_workers(threads)
+            results.add((cpp.vecsum(x, reproducible=True), cpp.vecdot(x, x, reproducible=True)))
+        cpp.set_workers(0)
+        self.assertEqual(len(results), 1)
+
+
+class StridedTest(unittest.TestCase):
+    def test_strided_and_reversed_views(self):
+        data = memoryview(array.array("d", range(10)))
+        self.assertEqual(list(cpp.vecadd(data[::2], data[1::2])), [1.0, 5.0, 9.0, 13.0, 17.0])
+        self.assertEqual(list(cpp.vecmul(data[::-3], data[:4])), [0.0, 6.0, 6.0, 0.0])
+
+    def test_other_element_types(self):
+        got = cpp.vecdiv(array.array("i", [1, 2, 3]), array.array("f", [2.0, 4.0, 0.5]))
+        self.assertEqual(list(got), [0.5, 0.5, 6.0])
+
+    def test_length_mismatch(self):
+        data = memoryview(array.array("d", range(10)))
+        with self.assertRaises(ValueError):
+            cpp.vecadd(data[::2], data[::3])
+
+
+class SaturateTest(unittest.TestCase):
+    def test_saturating_ops(self):
+        a, b = array.array("b", [100, -100, 5]), array.array("b", [100, -100, -6])
+        self.assertEqual(list(cpp.sat_add(a, b)), [127, -128, -1])
+        self.assertEqual(list(cpp.sat_sub(a, b)), [0, 0, 11])
+        self.assertEqual(list(cpp.sat_mul(array.array("H", [300, 2]), array.array("H", [300, 3]))), [65535, 6])
+
+    def test_out_and_q15(self):
+        out = array.array("h", [0] * 2)
+        got = cpp.q15_mul(array.array("h", [-32768, 16384]), array.array("h", [-32768, 16384]), out)
+        self.assertIs(got, out)
+        self.assertEqual(list(out), [32767, 8192])
+
+
+class HugePageTest(unittest.TestCase):
+    def tearDown(self):
+        cpp.set_huge_pages(32 << 20)
+
+    def test_defaults(self):
+        settings = cpp.huge_page_settings()
+        self.assertEqual((settings["threshold"], settings["prefault"]), (32 << 20, False))
+
+    def test_large_results(self):
+        cpp.set_huge_pages(1 << 20, prefault=True)
+        before = cpp.huge_page_settings()["allocations"]
+        n = 1 << 18
+        v = cpp.vecadd(cpp.Vector([1.0] * n), cpp.Vector([1.0] * n))
+        settings = cpp.huge_page_settings()
+        self.assertTrue(settings["prefault"])
+        self.assertGreaterEqual(settings["allocations"] - before, 3)
+        self.assertGreaterEqual(settings["mapped_bytes"], n * 8)  # only v is still alive
+        self.assertEqual((v[0], v[n - 1]), (2.0, 2.0))
+
+
+class ConcurrencyTest(unittest.TestCase):
+    def test_kernels_and_sketches_from_many_threads(self):
+        a = cpp.Vector([1.0] * 100000)
+        digest = cpp.TDigest()
+        chunk = array.array("d", range(1000))
+        sums, errors = [], []
+
+        def work():
+            try:
+                for _ in range(20):
+                    sums.append(cpp.vecsum(cpp.vecadd(a, a)))
+                    digest.update(chunk)
+                    cpp.set_tuning(grain=4096)
+            except Exception as e:  # surfaced below; a crash here would abort the run
+                errors.append(e)
+
+        calls = [threading.Thread(target=work) for _ in range(4)]
+        for t in calls:
+            t.start()
+        for t in calls:
+            t.join()
+        self.assertEqual(errors, [])
+        self.assertEqual(sums, [200000.0] * 80)
+        self.assertEqual(digest.count, 80 * 1000)
+
+
+class BatchingTest(unittest.TestCase):
+    def tearDown(self):
+        cpp.set_batching(False)
+
+    def test_concurrent_calls_are_batched(self):
+        cpp.set_batching(True, latency_us=1000, max_batch=8)
+        before = cpp.batching()["vecadd"]["requests"]
+        a = cpp.Vector([1.0] * 100)
+        results = []
+        calls = [threading.Thread(target=lambda: results.append(list(cpp.vecadd(a, a)))) for _ in range(8)]
+        for t in calls:
+            t.start()
+        for t in calls:
+            t.join()
+        self.assertEqual(results, [[2.0] * 100] * 8)
+        stats = cpp.batching()
+        self.assertTrue(stats["enabled"])
+        self.assertEqual(stats["vecadd"]["requests"] - before, 8)
+
+    def test_settings_are_checked(self):
+        with self.assertRaises(ValueError):
+            cpp.set_batching(True, latency_us=-1)
+
+
+class DiagnosticsTest(unittest.TestCase):
+    def test_diagnostics(self):
+        d = cpp.diagnostics()
+        self.assertGreaterEqual(d["import_ms"], 0)
+        self.assertEqual(d["pool_threads"] > 0, d["pool_started"])
+        self.assertIn("cpu_features", d)
+
+    def test_lazy_parts_start_on_use(self):
+        cpp.tuning()
+        cpp.vecadd([1.0] * 8, [1.0] * 8, where=bytes(8))  # masked kernels pick an ISA variant
+        d = cpp.diagnostics()
+        self.assertTrue(d["tuned"])
+        self.assertIsNotNone(d["cpu_features"])
+
+
+class BitmaskTest(unittest.TestCase):
+    def test_compare_and_logic(self):
+        x = [1.0, 2.0, 3.0, 4.0]
+        low, even = cpp.compare(x, 2.5, "<"), cpp.compare(x, [0.0, 2.0, 0.0, 4.0], "==")
+        self.assertEqual((len(low), low.count(), low[0], low[-1]), (4, 2, True, False))
+        self.assertEqual((low & even).tolist(), [False, True, False, False])
+        self.assertEqual((low | even).tolist(), [True, True, False, True])
+        self.assertEqual((low ^ even).tolist(), [True, False, False, True])
+        self.assertEqual((~low).tolist(), [False, False, True, True])
+        with self.assertRaises(ValueError):
+            cpp.compare(x, 0.0, "<>")
+
+    def test_predicates(self):
+        x = [1.0, math.nan, math.inf, 1.5]
+        self.assertEqual(cpp.isnan(x).tolist(), [False, True, False, False])
+        self.assertEqual(cpp.isfinite(x).tolist(), [True, False, False, True])
+        self.assertEqual(cpp.isclose(x, 1.2, 0.5).tolist(), [True, False, False, True])
+
+
+if __name__ == "__main__":
+    unittest.main()
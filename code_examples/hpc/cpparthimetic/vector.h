@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "parallel.h"
+#include "storage.h"
+
+// A float64 vector that is either an owner of its storage or a view [offset, offset + size) into
+// storage shared with other vectors.
+class Vector {
+public:
+    Vector() : Vector(size_t(0)) {}
+    explicit Vector(size_t n) : store(allocate_storage(n)), off(0), len(n) {}
+    Vector(std::shared_ptr<Storage> s, size_t offset, size_t length) : store(std::move(s)), off(offset), len(length) {
+        if (offset + length > store->size) throw std::out_of_range("view exceeds its storage");
+    }
+
+    double* data() const { return store->data + off; }
+    size_t size() const { return len; }
+    size_t offset() const { return off; }
+    bool readonly() const { return store->readonly; }
+    const std::shared_ptr<Storage>& storage() const { return store; }
+
+    Vector slice(size_t begin, size_t end) const {
+        end = std::min(end, len);
+        begin = std::min(begin, end);
+        return Vector(store, off + begin, end - begin);
+    }
+
+private:
+    std::shared_ptr<Storage> store;
+    size_t off, len;
+};
+
+const size_t copy_grain = 1 << 18;
+
+// Split into `parts` contiguous views whose lengths differ by at most one. No data is copied.
+inline std::vector<Vector> split(const Vector& v, size_t parts) {
+    if (parts == 0) throw std::invalid_argument("cannot split into zero parts");
+    std::vector<Vector> out;
+    size_t base = v.size() / parts, extra = v.size() % parts, begin = 0;
+    for (size_t p = 0; p < parts; p++) {
+        size_t length = base + (p < extra);
+        out.push_back(v.slice(begin, begin + length));
+        begin += length;
+    }
+    return out;
+}
+
+// Concatenate into one preallocated vector. The destination range is split evenly over the
+// workers, so a single large shard is copied by all of them.
+inline Vector merge(const std::vector<Vector>& parts) {
+    std::vector<size_t> starts(parts.size() + 1, 0);
+    for (size_t p = 0; p < parts.size(); p++) starts[p + 1] = starts[p] + parts[p].size();
+    Vector out(starts.back());
+    parallel_for(out.size(), copy_grain, [&](size_t, size_t begin, size_t end) {
+        size_t p = std::upper_bound(starts.begin(), starts.end(), begin) - starts.begin() - 1;
+        for (size_t i = begin; i < end; p++) {
+            size_t stop = std::min(end, starts[p + 1]);
+            if (stop > i) std::memcpy(out.data() + i, parts[p].data() + (i - starts[p]), (stop - i) * sizeof(double));
+            i = std::max(i, stop);
+        }
+    });
+    return out;
+}
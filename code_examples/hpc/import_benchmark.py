@@ -0,0 +1,61 @@
+"""Import-time budget for the native example modules.
+
+Each Covalent electron runs in a fresh process, so importing a module is part of every task's
+latency. This imports each module in new interpreters under ``-X importtime``, reports the
+median and worst self time of the module itself, and exits non-zero if the median is over
+budget. Build the modules in place first (``python setup.py build_ext --inplace``).
+"""
+
+import argparse
+import os
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+MODULES = ["cpparthimetic", "cpiapprox"]
+
+
+def import_time_us(module, path):
+    env = dict(os.environ, PYTHONPATH=os.pathsep.join(filter(None, [path, os.environ.get("PYTHONPATH")])))
+    out = subprocess.run(
+        [sys.executable, "-X", "importtime", "-c", f"import {module}"],
+        env=env, capture_output=True, text=True, check=True,
+    )
+    for line in out.stderr.splitlines():
+        fields = [f.strip() for f in line.split("|")]
+        if len(fields) == 3 and fields[2] == module:
+            return int(fields[0].split(":")[1])
+    raise RuntimeError(f"no import time reported for {module}")
+
+
+def diagnostics(module, path):
+    out = subprocess.run(
+        [sys.executable, "-c", f"import {module}; print({module}.diagnostics())"],
+        cwd=path, capture_output=True, text=True, check=True,
+    )
+    return out.stdout.strip()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("modules", nargs="*", default=MODULES, choices=MODULES)
+    parser.add_argument("--runs", type=int, default=20, help="fresh interpreters per module")
+    parser.add_argument("--budget-us", type=float, default=1000.0, help="limit on the median")
+    args = parser.parse_args()
+
+    failed = False
+    for module in args.modules:
+        path = os.path.join(HERE, module)
+        times = [import_time_us(module, path) for _ in range(args.runs)]
+        median = statistics.median(times)
+        ok = median <= args.budget_us
+        failed |= not ok
+        print(f"{module}: median {median:.0f} us, max {max(times)} us over {args.runs} runs"
+              f" ({'ok' if ok else 'over budget'}, budget {args.budget_us:.0f} us)")
+        print(f"  {diagnostics(module, path)}")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())